@@ -0,0 +1,210 @@
+//=======================================================================================================
+// Copyright 2015 Asgeir Bjorgan, Lise Lyngsnes Randeberg, Norwegian University of Science and Technology
+// Distributed under the MIT License.
+// (See accompanying file LICENSE or copy at
+// http://opensource.org/licenses/MIT)
+//=======================================================================================================
+
+//Compares random band and spectrum access in an ENVI image and in its cube cache file (see hyconvert).
+//Both files are dropped from the page cache before each pass, so the passes read from disk. The raw file is read
+//as sparingly as BIL allows: one row per line for a band, one value per band for a spectrum.
+//Reports time per band or spectrum, and the bytes read from disk as counted by the kernel (/proc/self/io).
+//Usage: cubecachebench [imagefile] [cachefile.hyc]
+
+#include "cubecache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <vector>
+using namespace std;
+
+const int BENCH_BANDS = 20;
+const int BENCH_SPECTRA = 200;
+
+double elapsedMilliseconds(struct timespec start){
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start.tv_sec)*1000.0 + (end.tv_nsec - start.tv_nsec)/1000000.0;
+}
+
+//bytes this process has caused to be read from storage
+size_t storageReadBytes(){
+	FILE *fp = fopen("/proc/self/io", "r");
+	if (fp == NULL){
+		return 0;
+	}
+	char line[256];
+	size_t bytes = 0;
+	while (fgets(line, sizeof(line), fp) != NULL){
+		if (strncmp(line, "read_bytes:", 11) == 0){
+			bytes = strtoull(line + 11, NULL, 10);
+		}
+	}
+	fclose(fp);
+	return bytes;
+}
+
+void dropFromPageCache(const char *filename){
+	int fd = open(filename, O_RDONLY);
+	if (fd >= 0){
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(fd);
+	}
+}
+
+//raw value at the given file position, converted to float
+float readRawValue(FILE *fp, HyspexHeader *header, size_t position){
+	if (header->datatype == 12){
+		uint16_t value = 0;
+		fseeko(fp, header->offset + position*sizeof(uint16_t), SEEK_SET);
+		if (fread(&value, sizeof(uint16_t), 1, fp) != 1){
+			fprintf(stderr, "Could not read image file\n");
+			exit(1);
+		}
+		return value;
+	} else {
+		float value = 0;
+		fseeko(fp, header->offset + position*sizeof(float), SEEK_SET);
+		if (fread(&value, sizeof(float), 1, fp) != 1){
+			fprintf(stderr, "Could not read image file\n");
+			exit(1);
+		}
+		return value;
+	}
+}
+
+//band image from the raw file, one row per line
+void readRawBand(FILE *fp, HyspexHeader *header, int band, float *bandImage){
+	size_t valueBytes = (header->datatype == 12) ? sizeof(uint16_t) : sizeof(float);
+	vector<unsigned char> row(header->samples*valueBytes);
+	for (int i=0; i < header->lines; i++){
+		size_t position = ((size_t)i*header->bands + band)*header->samples;
+		fseeko(fp, header->offset + position*valueBytes, SEEK_SET);
+		if (fread(&row[0], valueBytes, header->samples, fp) != (size_t)header->samples){
+			fprintf(stderr, "Could not read image file\n");
+			exit(1);
+		}
+		for (int j=0; j < header->samples; j++){
+			if (header->datatype == 12){
+				bandImage[(size_t)i*header->samples + j] = ((uint16_t*)&row[0])[j];
+			} else {
+				bandImage[(size_t)i*header->samples + j] = ((float*)&row[0])[j];
+			}
+		}
+	}
+}
+
+void printResult(const char *name, double milliseconds, size_t bytes, int count, const char *unit){
+	printf("%-34s %10.2f ms/%s %12.0f bytes read/%s\n", name, milliseconds/count, unit, bytes*1.0/count, unit);
+}
+
+int main(int argc, char *argv[]){
+	if (argc < 3){
+		fprintf(stderr, "Usage: cubecachebench [imagefile] [cachefile.hyc]\n");
+		exit(1);
+	}
+	char *imageFilename = argv[1];
+	char *cacheFilename = argv[2];
+
+	HyspexHeader header;
+	hyperspectral_read_header(imageFilename, &header);
+	FILE *fp = fopen(imageFilename, "rb");
+	if (fp == NULL){
+		fprintf(stderr, "Could not open file: %s\n", imageFilename);
+		exit(1);
+	}
+	setvbuf(fp, NULL, _IONBF, 0); //let the kernel decide how much to read, as for the cube cache reads
+
+	ImageSubset subset;
+	subset.startLine = 0;
+	subset.endLine = header.lines;
+	subset.startSamp = 0;
+	subset.endSamp = header.samples;
+
+	vector<int> bands(BENCH_BANDS);
+	srand(1);
+	for (int i=0; i < BENCH_BANDS; i++){
+		bands[i] = rand() % header.bands;
+	}
+	vector<int> lines(BENCH_SPECTRA);
+	vector<int> samples(BENCH_SPECTRA);
+	for (int i=0; i < BENCH_SPECTRA; i++){
+		lines[i] = rand() % header.lines;
+		samples[i] = rand() % header.samples;
+	}
+
+	vector<float> bandImage((size_t)header.lines*header.samples);
+	vector<float> cacheBandImage((size_t)header.lines*header.samples);
+	vector<float> spectrum(header.bands);
+	vector<float> cacheSpectrum(header.bands);
+	struct timespec start;
+	size_t startBytes;
+	long mismatches = 0;
+
+	//random bands, raw
+	dropFromPageCache(imageFilename);
+	startBytes = storageReadBytes();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i=0; i < BENCH_BANDS; i++){
+		readRawBand(fp, &header, bands[i], &bandImage[0]);
+	}
+	printResult("random band, raw file", elapsedMilliseconds(start), storageReadBytes() - startBytes, BENCH_BANDS, "band");
+
+	//random bands, cube cache, compared against the raw file
+	dropFromPageCache(cacheFilename);
+	startBytes = storageReadBytes();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	CubeCache *cache = cubecache_open(cacheFilename);
+	double cacheTime = 0;
+	for (int i=0; i < BENCH_BANDS; i++){
+		cubecache_read_band(cache, subset, bands[i], &cacheBandImage[0]);
+		cacheTime += elapsedMilliseconds(start);
+
+		readRawBand(fp, &header, bands[i], &bandImage[0]);
+		mismatches += memcmp(&bandImage[0], &cacheBandImage[0], sizeof(float)*bandImage.size()) != 0;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+	}
+	size_t cacheBytes = storageReadBytes() - startBytes;
+	cubecache_close(cache);
+	dropFromPageCache(imageFilename);
+	printResult("random band, cube cache", cacheTime, cacheBytes, BENCH_BANDS, "band");
+
+	//random spectra, raw
+	dropFromPageCache(imageFilename);
+	startBytes = storageReadBytes();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i=0; i < BENCH_SPECTRA; i++){
+		for (int k=0; k < header.bands; k++){
+			spectrum[k] = readRawValue(fp, &header, ((size_t)lines[i]*header.bands + k)*header.samples + samples[i]);
+		}
+	}
+	printResult("random spectrum, raw file", elapsedMilliseconds(start), storageReadBytes() - startBytes, BENCH_SPECTRA, "spectrum");
+
+	//random spectra, cube cache
+	dropFromPageCache(cacheFilename);
+	startBytes = storageReadBytes();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	cache = cubecache_open(cacheFilename);
+	for (int i=0; i < BENCH_SPECTRA; i++){
+		cubecache_read_spectrum(cache, subset, lines[i], samples[i], &cacheSpectrum[0]);
+	}
+	printResult("random spectrum, cube cache", elapsedMilliseconds(start), storageReadBytes() - startBytes, BENCH_SPECTRA, "spectrum");
+	for (int i=0; i < BENCH_SPECTRA; i++){
+		cubecache_read_spectrum(cache, subset, lines[i], samples[i], &cacheSpectrum[0]);
+		for (int k=0; k < header.bands; k++){
+			spectrum[k] = readRawValue(fp, &header, ((size_t)lines[i]*header.bands + k)*header.samples + samples[i]);
+		}
+		mismatches += memcmp(&spectrum[0], &cacheSpectrum[0], sizeof(float)*header.bands) != 0;
+	}
+	cubecache_close(cache);
+	fclose(fp);
+
+	if (mismatches > 0){
+		fprintf(stderr, "%ld bands or spectra differ between the raw file and the cube cache\n", mismatches);
+		exit(1);
+	}
+}
@@ -0,0 +1,96 @@
+//=======================================================================================================
+// Copyright 2015 Asgeir Bjorgan, Lise Lyngsnes Randeberg, Norwegian University of Science and Technology
+// Distributed under the MIT License.
+// (See accompanying file LICENSE or copy at
+// http://opensource.org/licenses/MIT)
+//=======================================================================================================
+
+//Compares datacubes allocated with new[] against hyperspectral_alloc_image(): allocation and fill,
+//strided band reads as in the image viewer statistics, and strided spectrum reads without the spectral cache.
+//Usage: hugepagebench [lines] (samples = 1024, bands = 256, default 1536 lines = 1.6 GB)
+
+#include "readimage.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+const int BENCH_SAMPLES = 1024;
+const int BENCH_BANDS = 256;
+const int BENCH_BAND_STEP = 8;
+const int BENCH_SPECTRA = 200000;
+
+double elapsedMilliseconds(struct timespec start){
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start.tv_sec)*1000.0 + (end.tv_nsec - start.tv_nsec)/1000000.0;
+}
+
+//sum of one band, read line by line from a BIL datacube
+double sumBand(float *data, int lines, int band){
+	double sum = 0;
+	for (int i=0; i < lines; i++){
+		float *line = data + (size_t)i*BENCH_SAMPLES*BENCH_BANDS + (size_t)band*BENCH_SAMPLES;
+		for (int j=0; j < BENCH_SAMPLES; j++){
+			sum += line[j];
+		}
+	}
+	return sum;
+}
+
+void runBenchmark(int lines, bool hugePages){
+	size_t numElements = (size_t)lines*BENCH_SAMPLES*BENCH_BANDS;
+	struct timespec start;
+
+	//allocate and fill, faulting in the memory before filling it in both cases
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	float *data;
+	if (hugePages){
+		data = hyperspectral_alloc_image(numElements, true);
+	} else {
+		data = new float[numElements];
+		for (size_t i=0; i < numElements; i += 1024){
+			data[i] = 0;
+		}
+	}
+	for (size_t i=0; i < numElements; i++){
+		data[i] = i % 1024;
+	}
+	double allocTime = elapsedMilliseconds(start);
+
+	//band reads
+	double sum = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int band=0; band < BENCH_BANDS; band += BENCH_BAND_STEP){
+		sum += sumBand(data, lines, band);
+	}
+	double bandTime = elapsedMilliseconds(start)/(BENCH_BANDS/BENCH_BAND_STEP);
+
+	//spectrum reads at random pixels
+	srand(1);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i=0; i < BENCH_SPECTRA; i++){
+		int line = rand() % lines;
+		int sample = rand() % BENCH_SAMPLES;
+		for (int k=0; k < BENCH_BANDS; k++){
+			sum += data[(size_t)line*BENCH_SAMPLES*BENCH_BANDS + (size_t)k*BENCH_SAMPLES + sample];
+		}
+	}
+	double spectrumTime = elapsedMilliseconds(start)*1000.0/BENCH_SPECTRA;
+
+	printf("%s allocate + fill %.0f ms, band %.2f ms, spectrum %.2f us (checksum %g)\n", hugePages ? "hyperspectral_alloc_image" : "new[]                    ", allocTime, bandTime, spectrumTime, sum);
+
+	if (hugePages){
+		hyperspectral_free_image(data, numElements);
+	} else {
+		delete [] data;
+	}
+}
+
+int main(int argc, char *argv[]){
+	int lines = 1536;
+	if (argc > 1){
+		lines = atoi(argv[1]);
+	}
+	runBenchmark(lines, false);
+	runBenchmark(lines, true);
+}
@@ -0,0 +1,75 @@
+//=======================================================================================================
+// Copyright 2015 Asgeir Bjorgan, Lise Lyngsnes Randeberg, Norwegian University of Science and Technology
+// Distributed under the MIT License.
+// (See accompanying file LICENSE or copy at
+// http://opensource.org/licenses/MIT)
+//=======================================================================================================
+
+#include "bandStatistics.h"
+#include <math.h>
+#include <float.h>
+
+bool isValidValue(float val){
+	return (0*val == 0*val); //should check for both Inf and NaN. Not sure if platform independent.
+}
+
+void band_statistics_reset(BandStatistics *stats){
+	stats->n = 0;
+	stats->mean = 0;
+	stats->M2 = 0;
+	stats->max = -FLT_MAX;
+	stats->min = FLT_MAX;
+}
+
+void band_statistics_accumulate(BandStatistics *stats, const float *values, int numValues){
+	for (int j=0; j < numValues; j++){
+		float val = values[j];
+		if (isValidValue(val)){ //check for NaN and Inf, in case the input image is sketchy
+			stats->n++;
+			double delta = val - stats->mean;
+			stats->mean = stats->mean + delta/(1.0f*stats->n);
+			stats->M2 = stats->M2 + delta*(val - stats->mean);
+		} else {
+			val = 0;
+		}
+		if (val > stats->max){
+			stats->max = val;
+		}
+		if (val < stats->min){
+			stats->min = val;
+		}
+	}
+}
+
+double band_statistics_std(BandStatistics *stats){
+	return sqrt(stats->M2/(stats->n-1));
+}
+
+void band_statistics_range(BandStatistics *stats, float *min, float *max){
+	*min = stats->min;
+	*max = stats->max;
+
+	double std = band_statistics_std(stats);
+	if (isValidValue(stats->mean) && isValidValue(std)){
+		//mean is well-defined, define new min and max from dynamic ranges
+		*max = stats->mean + 2*std;
+		*min = stats->mean - 2*std;
+	}
+}
+
+void band_to_greyscale(const float *values, int numValues, float min, float max, unsigned char *output, int outputStride){
+	float scale = (max > min) ? 255.0f/(max - min) : 0;
+	for (int j=0; j < numValues; j++){
+		float val = values[j];
+		if (!isValidValue(val)){
+			val = 0;
+		}
+		if (val > max){
+			val = max;
+		}
+		if (val < min){
+			val = min;
+		}
+		output[j*outputStride] = (unsigned char)((val - min)*scale);
+	}
+}
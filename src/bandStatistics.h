@@ -0,0 +1,35 @@
+//=======================================================================================================
+// Copyright 2015 Asgeir Bjorgan, Lise Lyngsnes Randeberg, Norwegian University of Science and Technology
+// Distributed under the MIT License.
+// (See accompanying file LICENSE or copy at
+// http://opensource.org/licenses/MIT)
+//=======================================================================================================
+
+#ifndef BANDSTATISTICS_H_DEFINED
+#define BANDSTATISTICS_H_DEFINED
+
+//Running statistics of the values in a band image, used for choosing the dynamic range when displaying it.
+typedef struct {
+	long n; //number of valid values
+	double mean;
+	double M2; //sum of squared differences from the mean
+	float min;
+	float max;
+} BandStatistics;
+
+bool isValidValue(float val); //false for NaN and Inf
+
+void band_statistics_reset(BandStatistics *stats);
+
+//add values to the statistics (Welford's algorithm). NaN and Inf are counted as 0 in min and max, and otherwise ignored.
+void band_statistics_accumulate(BandStatistics *stats, const float *values, int numValues);
+
+double band_statistics_std(BandStatistics *stats);
+
+//dynamic range used for display: mean +/- 2 standard deviations when the mean is well-defined, otherwise min and max
+void band_statistics_range(BandStatistics *stats, float *min, float *max);
+
+//convert values to 8-bit grey levels, clamped to the range [min, max]. NaN and Inf are treated as 0. Output is written to every outputStride-th byte.
+void band_to_greyscale(const float *values, int numValues, float min, float max, unsigned char *output, int outputStride = 1);
+
+#endif
@@ -0,0 +1,235 @@
+//=======================================================================================================
+// Copyright 2015 Asgeir Bjorgan, Lise Lyngsnes Randeberg, Norwegian University of Science and Technology
+// Distributed under the MIT License.
+// (See accompanying file LICENSE or copy at
+// http://opensource.org/licenses/MIT)
+//=======================================================================================================
+
+#include "cubeSession.h"
+#include "imageViewer.h"
+#include "imageLoader.h"
+#include <QFileInfo>
+#include <QGridLayout>
+#include <QLabel>
+#include <stdio.h>
+#include <algorithm>
+using namespace std;
+
+//memory manager id of the datacube of a CubeTab
+const int CUBE_DATA_ID = 0;
+
+/////////////
+// CubeTab //
+/////////////
+
+//filename as expected by hyperspectral_read_calibration
+const char *calibrationFilename(const string &filename){
+	return filename.empty() ? NULL : filename.c_str();
+}
+
+ImageSubset getCubeSubset(const CubeOptions &options, const HyspexHeader &header){
+	ImageSubset subset = options.subset;
+	if (!subset.endLine){
+		subset.endLine = header.lines;
+	}
+	if (!subset.endSamp){
+		subset.endSamp = header.samples;
+	}
+	return subset;
+}
+
+bool getCubeResampling(const CubeOptions &options, const HyspexHeader &header, SpectralResampling *resampling){
+	if (options.resampleWlens.size() > 0){
+		*resampling = hyperspectral_resampling(header.wlens, options.resampleWlens);
+		return true;
+	} else if (options.binSize > 1){
+		*resampling = hyperspectral_binning(header.wlens, options.binSize);
+		return true;
+	}
+	return false;
+}
+
+bool getCubeCalibration(const CubeOptions &options, const HyspexHeader &header, RadiometricCalibration *calibration){
+	if (options.darkFilename.empty() && options.gainFilename.empty() && options.offsetFilename.empty()){
+		return false;
+	}
+	*calibration = hyperspectral_read_calibration(&header, calibrationFilename(options.darkFilename), calibrationFilename(options.gainFilename), calibrationFilename(options.offsetFilename));
+	return true;
+}
+
+void warnCubeCacheOptions(const CubeOptions &options, const string &filename){
+	bool resample = (options.binSize > 1) || (options.resampleWlens.size() > 0);
+	bool calibrate = !options.darkFilename.empty() || !options.gainFilename.empty() || !options.offsetFilename.empty();
+	if (resample || calibrate){
+		fprintf(stderr, "Spectral resampling and radiometric calibration are not supported for cube cache files, ignoring for %s.\n", filename.c_str());
+	}
+}
+
+CubeTab::CubeTab(string filename, CubeOptions options, MemoryManager *memoryManager, QWidget *parent) : QWidget(parent), filename(filename), options(options), memoryManager(memoryManager), active(false), data(NULL), dataElements(0), cache(NULL), loader(NULL), viewer(NULL){
+	placeholder = new QLabel("Not loaded");
+	placeholder->setAlignment(Qt::AlignCenter);
+
+	QGridLayout *layout = new QGridLayout(this);
+	layout->setContentsMargins(0, 0, 0, 0);
+	layout->addWidget(placeholder, 0, 0);
+}
+
+CubeTab::~CubeTab(){
+	memoryManager->release(this, CUBE_DATA_ID);
+	unload();
+}
+
+void CubeTab::activate(){
+	active = true;
+	if (viewer == NULL){
+		load();
+	}
+	memoryManager->setPinned(this, CUBE_DATA_ID, true);
+}
+
+void CubeTab::deactivate(){
+	active = false;
+
+	//keep the datacube pinned until the loader has finished writing to it
+	if ((loader == NULL) || loader->isFinished()){
+		memoryManager->setPinned(this, CUBE_DATA_ID, false);
+	}
+}
+
+void CubeTab::loadingFinished(){
+	if (!active){
+		memoryManager->setPinned(this, CUBE_DATA_ID, false);
+	}
+}
+
+void CubeTab::evictMemory(int id){
+	//the datacube is pinned from load() until the tab is deactivated and the loader has finished, so it is never evicted while in use
+	Q_UNUSED(id);
+	unload();
+}
+
+void CubeTab::load(){
+	//read header
+	HyspexHeader header;
+	if (cubecache_is_cache_file(filename.c_str())){
+		cache = cubecache_open(filename.c_str());
+		header = cache->header;
+	} else {
+		hyperspectral_read_header(&filename[0], &header);
+	}
+
+	//configure image subset
+	ImageSubset subset = getCubeSubset(options, header);
+	int newLines = subset.endLine - subset.startLine;
+	int newSamples = subset.endSamp - subset.startSamp;
+
+	if (cache != NULL){
+		warnCubeCacheOptions(options, filename);
+
+		//blocks are read from the cube cache file on demand, only the current band and the decoded blocks need to be accounted for.
+		//Decoded blocks are limited to a quarter of the budget, leaving room for other datacubes and rendered bands. Should that
+		//be less than a band block of a file with several bands per block, cubecache_read_band() still reuses part of it.
+		cache->maxDecodedBytes = min(cache->maxDecodedBytes, memoryManager->getBudget()/4);
+		memoryManager->reserve(this, CUBE_DATA_ID, sizeof(float)*newLines*newSamples + cache->maxDecodedBytes, true);
+		viewer = new ImageViewer(cache, subset, memoryManager);
+	} else {
+		//spectral binning or resampling
+		SpectralResampling bandGrid;
+		SpectralResampling *resampling = getCubeResampling(options, header, &bandGrid) ? &bandGrid : NULL;
+		int newBands = (resampling != NULL) ? resampling->wlens.size() : header.bands;
+		vector<float> wlens = (resampling != NULL) ? resampling->wlens : header.wlens;
+
+		//allocate hyperspectral image, and fill it in the background
+		dataElements = (size_t)newLines*newSamples*newBands;
+		memoryManager->reserve(this, CUBE_DATA_ID, sizeof(float)*dataElements, true);
+		data = hyperspectral_alloc_image(dataElements); //prefaulted by the loader if options.populate is set
+		viewer = new ImageViewer(data, newLines, newSamples, newBands, wlens, 0, memoryManager);
+		viewer->setSpectralCache(options.spectralCache);
+
+		//subset, resampling and radiometric calibration are applied by the loader
+		loader = new ImageLoader(filename, header, options, data);
+		connect(loader, SIGNAL(linesLoaded(int)), viewer, SLOT(setLoadedLines(int)));
+		connect(loader, SIGNAL(finished()), SLOT(loadingFinished()));
+		loader->start();
+	}
+
+	placeholder->hide();
+	layout()->addWidget(viewer);
+	emit viewerCreated(viewer);
+}
+
+void CubeTab::unload(){
+	if (loader != NULL){
+		loader->requestInterruption();
+		loader->wait();
+		delete loader;
+		loader = NULL;
+	}
+
+	delete viewer;
+	viewer = NULL;
+
+	hyperspectral_free_image(data, dataElements);
+	data = NULL;
+	if (cache != NULL){
+		cubecache_close(cache);
+		cache = NULL;
+	}
+	placeholder->show();
+}
+
+/////////////////
+// CubeSession //
+/////////////////
+
+CubeSession::CubeSession(vector<string> filenames, CubeOptions options, MemoryManager *memoryManager, QWidget *parent) : QTabWidget(parent), activeTab(-1){
+	#ifdef WITH_QWT
+	spectrumDisplayer = new SpectrumDisplayer;
+	spectrumDisplayer->show();
+	#endif
+
+	for (int i=0; i < (int)filenames.size(); i++){
+		CubeTab *tab = new CubeTab(filenames[i], options, memoryManager);
+		connect(tab, SIGNAL(viewerCreated(ImageViewer*)), SLOT(connectViewer(ImageViewer*)));
+		tabs.push_back(tab);
+
+		QString filename = QString::fromStdString(filenames[i]);
+		addTab(tab, QFileInfo(filename).fileName());
+		setTabToolTip(i, filename);
+	}
+	setTabBarAutoHide(true);
+
+	//datacubes are loaded when first displayed
+	connect(this, SIGNAL(currentChanged(int)), SLOT(switchCube(int)));
+	switchCube(currentIndex());
+}
+
+CubeSession::~CubeSession(){
+	#ifdef WITH_QWT
+	delete spectrumDisplayer;
+	#endif
+}
+
+void CubeSession::switchCube(int index){
+	//deactivate the previous datacube first, so that it can be evicted for making room for the new one
+	if (activeTab != -1){
+		tabs[activeTab]->deactivate();
+	}
+	activeTab = index;
+	if (index != -1){
+		tabs[index]->activate();
+	}
+
+	#ifdef WITH_QWT
+	//hover spectrum belongs to the previous datacube
+	spectrumDisplayer->displayHoverSpectrum(0, 0, NULL, NULL, 0);
+	#endif
+}
+
+void CubeSession::connectViewer(ImageViewer *viewer){
+	#ifdef WITH_QWT
+	viewer->connectSpectrumDisplayer(spectrumDisplayer);
+	#else
+	Q_UNUSED(viewer);
+	#endif
+}
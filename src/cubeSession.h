@@ -0,0 +1,102 @@
+//=======================================================================================================
+// Copyright 2015 Asgeir Bjorgan, Lise Lyngsnes Randeberg, Norwegian University of Science and Technology
+// Distributed under the MIT License.
+// (See accompanying file LICENSE or copy at
+// http://opensource.org/licenses/MIT)
+//=======================================================================================================
+
+
+#ifndef CUBESESSION_H_DEFINED
+#define CUBESESSION_H_DEFINED
+
+#include <QTabWidget>
+#include <string>
+#include <vector>
+#include "readimage.h"
+#include "cubecache.h"
+#include "memoryManager.h"
+
+//options applied when loading each datacube of a CubeSession
+typedef struct {
+	ImageSubset subset; //end line and end sample set to 0 denote the full image
+	bool spectralCache; //see ImageViewer::setSpectralCache
+	int binSize; //average each binSize adjacent bands while loading. No binning if 0 or 1.
+	std::vector<float> resampleWlens; //resample to these wavelengths while loading, if not empty
+	bool populate; //fault in the pages of the datacube before loading it, see hyperspectral_populate_image
+
+	//radiometric calibration images applied while loading, see hyperspectral_read_calibration. Empty filenames are not used.
+	std::string darkFilename;
+	std::string gainFilename;
+	std::string offsetFilename;
+} CubeOptions;
+
+//image subset of a datacube with the given header, end values of 0 replaced by the full image size
+ImageSubset getCubeSubset(const CubeOptions &options, const HyspexHeader &header);
+
+//spectral binning or resampling of a datacube with the given header. Returns false if the bands are to be used as they are.
+bool getCubeResampling(const CubeOptions &options, const HyspexHeader &header, SpectralResampling *resampling);
+
+//radiometric calibration of a datacube with the given header. Returns false if no calibration images are given.
+bool getCubeCalibration(const CubeOptions &options, const HyspexHeader &header, RadiometricCalibration *calibration);
+
+//print a warning if spectral resampling or radiometric calibration is requested, neither is supported for cube cache files
+void warnCubeCacheOptions(const CubeOptions &options, const std::string &filename);
+
+class QLabel;
+class ImageViewer;
+class ImageLoader;
+#ifdef WITH_QWT
+class SpectrumDisplayer;
+#endif
+
+//A single datacube in a CubeSession. The datacube is loaded when the tab is first activated, and can be evicted by
+//the memory manager while the tab is inactive, in which case it is loaded again on the next activation.
+class CubeTab : public QWidget, public MemoryConsumer{
+	Q_OBJECT
+	public:
+		CubeTab(std::string filename, CubeOptions options, MemoryManager *memoryManager, QWidget *parent = NULL);
+		~CubeTab();
+		void activate(); //load datacube if necessary, keep it in memory while active
+		void deactivate(); //allow datacube to be evicted
+		void evictMemory(int id);
+	signals:
+		void viewerCreated(ImageViewer *viewer);
+	private slots:
+		void loadingFinished();
+	private:
+		void load();
+		void unload();
+
+		std::string filename;
+		CubeOptions options;
+		MemoryManager *memoryManager;
+		bool active;
+
+		//loaded datacube, either fully in memory or as a cube cache file
+		float *data;
+		size_t dataElements;
+		CubeCache *cache;
+		ImageLoader *loader;
+		ImageViewer *viewer;
+
+		QLabel *placeholder; //displayed while the datacube is not loaded
+};
+
+//Tabbed viewer of several datacubes sharing a single memory budget.
+class CubeSession : public QTabWidget{
+	Q_OBJECT
+	public:
+		CubeSession(std::vector<std::string> filenames, CubeOptions options, MemoryManager *memoryManager, QWidget *parent = NULL);
+		~CubeSession();
+	private slots:
+		void switchCube(int index);
+		void connectViewer(ImageViewer *viewer);
+	private:
+		std::vector<CubeTab*> tabs;
+		int activeTab;
+		#ifdef WITH_QWT
+		SpectrumDisplayer *spectrumDisplayer; //shared between all datacubes
+		#endif
+};
+
+#endif
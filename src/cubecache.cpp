@@ -0,0 +1,431 @@
+//=======================================================================================================
+// Copyright 2015 Asgeir Bjorgan, Lise Lyngsnes Randeberg, Norwegian University of Science and Technology
+// Distributed under the MIT License.
+// (See accompanying file LICENSE or copy at
+// http://opensource.org/licenses/MIT)
+//=======================================================================================================
+
+#include "cubecache.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+using namespace std;
+
+const char CUBECACHE_MAGIC[] = "HYCUBE02";
+const int CUBECACHE_MAGIC_LENGTH = 8;
+
+//number of residuals sharing the same bit width
+const int CUBECACHE_GROUP_SIZE = 16;
+
+//bytes allocated after an encoded block, read but not used by cubecache_decode()
+const size_t CUBECACHE_DECODE_PADDING = sizeof(uint64_t);
+
+//size of a value in the image file, and of a value in a block stored without coding
+size_t cubecache_raw_value_bytes(int datatype);
+
+//number of values contained in a block
+size_t cubecache_block_values(CubeCache *cache, int lineBlock, int sampleBlock, int bandBlock);
+
+//get decoded block, reading and decompressing it from file if necessary
+float *cubecache_get_block(CubeCache *cache, int lineBlock, int sampleBlock, int bandBlock);
+
+//delta code rows of length samples, bit-pack residuals. Output is appended to encoded.
+void cubecache_encode(float *values, size_t numValues, int samples, int datatype, vector<unsigned char> *encoded);
+
+//inverse of cubecache_encode
+void cubecache_decode(unsigned char *encoded, size_t numValues, int samples, int datatype, float *values);
+
+//store values as they are in the image file, for blocks that cubecache_encode() does not make smaller
+void cubecache_store_raw(float *values, size_t numValues, int datatype, vector<unsigned char> *encoded);
+
+//inverse of cubecache_store_raw
+void cubecache_load_raw(unsigned char *encoded, size_t numValues, int datatype, float *values);
+
+
+bool cubecache_is_cache_file(const char *filename){
+	const char *extension = strrchr(filename, '.');
+	return (extension != NULL) && (strcmp(extension, ".hyc") == 0);
+}
+
+size_t cubecache_raw_value_bytes(int datatype){
+	return (datatype == 12) ? sizeof(uint16_t) : sizeof(float);
+}
+
+void cubecache_convert(char *imageFilename, const char *cacheFilename, int blockLines, int blockSamples, int blockBands){
+	HyspexHeader header;
+	hyperspectral_read_header(imageFilename, &header);
+
+	FILE *fp = fopen(cacheFilename, "wb");
+	if (fp == NULL){
+		fprintf(stderr, "Could not open file for writing: %s\n", cacheFilename);
+		exit(1);
+	}
+
+	int numLineBlocks = (header.lines + blockLines - 1)/blockLines;
+	int numSampleBlocks = (header.samples + blockSamples - 1)/blockSamples;
+	int numBandBlocks = (header.bands + blockBands - 1)/blockBands;
+	int numBlocks = numLineBlocks*numSampleBlocks*numBandBlocks;
+
+	//header
+	int32_t dims[7] = {header.lines, header.samples, header.bands, header.datatype, blockLines, blockSamples, blockBands};
+	fwrite(CUBECACHE_MAGIC, sizeof(char), CUBECACHE_MAGIC_LENGTH, fp);
+	fwrite(dims, sizeof(int32_t), 7, fp);
+	fwrite(&(header.wlens[0]), sizeof(float), header.bands, fp);
+
+	//placeholder for index, filled in when the block sizes are known
+	vector<uint64_t> offsets(numBlocks+1, 0);
+	off_t indexPosition = ftello(fp);
+	fwrite(&(offsets[0]), sizeof(uint64_t), numBlocks+1, fp);
+
+	float *lineData = new float[(size_t)blockLines*header.samples*header.bands];
+	float *blockData = new float[(size_t)blockLines*blockSamples*blockBands];
+	vector<unsigned char> encoded;
+	size_t rawBytes = 0;
+	int numRawBlocks = 0;
+
+	for (int lb=0; lb < numLineBlocks; lb++){
+		//read all bands of the lines in this line block
+		ImageSubset subset;
+		subset.startSamp = 0;
+		subset.endSamp = header.samples;
+		subset.startLine = lb*blockLines;
+		subset.endLine = subset.startLine + blockLines;
+		if (subset.endLine > header.lines){
+			subset.endLine = header.lines;
+		}
+		int numLines = subset.endLine - subset.startLine;
+		hyperspectral_read_image(imageFilename, &header, subset, lineData);
+
+		for (int sb=0; sb < numSampleBlocks; sb++){
+			int startSample = sb*blockSamples;
+			int numSamples = min(blockSamples, header.samples - startSample);
+			for (int bb=0; bb < numBandBlocks; bb++){
+				//extract the samples and bands of this block, keeping BIL order
+				int startBand = bb*blockBands;
+				int numBands = min(blockBands, header.bands - startBand);
+				for (int i=0; i < numLines; i++){
+					for (int k=0; k < numBands; k++){
+						memcpy(blockData + ((size_t)i*numBands + k)*numSamples, lineData + ((size_t)i*header.bands + startBand + k)*header.samples + startSample, sizeof(float)*numSamples);
+					}
+				}
+
+				//keep the block as it is if coding does not make it smaller, so that the file never grows beyond the image
+				size_t numValues = (size_t)numLines*numBands*numSamples;
+				size_t blockRawBytes = numValues*cubecache_raw_value_bytes(header.datatype);
+				encoded.clear();
+				cubecache_encode(blockData, numValues, numSamples, header.datatype, &encoded);
+				if (encoded.size() >= blockRawBytes){
+					encoded.clear();
+					cubecache_store_raw(blockData, numValues, header.datatype, &encoded);
+					numRawBlocks++;
+				}
+
+				offsets[(lb*numSampleBlocks + sb)*numBandBlocks + bb] = ftello(fp);
+				fwrite(&(encoded[0]), sizeof(unsigned char), encoded.size(), fp);
+				rawBytes += blockRawBytes;
+			}
+		}
+		fprintf(stderr, "\rConverted %d/%d lines", subset.endLine, header.lines);
+	}
+	offsets[numBlocks] = ftello(fp);
+	fprintf(stderr, "\nCompressed size: %lu bytes, original: %lu bytes (ratio %f), %d of %d blocks stored uncompressed\n", (unsigned long)offsets[numBlocks], (unsigned long)rawBytes, rawBytes*1.0/offsets[numBlocks], numRawBlocks, numBlocks);
+
+	//write index
+	fseeko(fp, indexPosition, SEEK_SET);
+	fwrite(&(offsets[0]), sizeof(uint64_t), numBlocks+1, fp);
+	fclose(fp);
+
+	delete [] lineData;
+	delete [] blockData;
+}
+
+CubeCache *cubecache_open(const char *filename){
+	FILE *fp = fopen(filename, "rb");
+	if (fp == NULL){
+		fprintf(stderr, "Could not open file: %s\n", filename);
+		exit(1);
+	}
+
+	char magic[CUBECACHE_MAGIC_LENGTH];
+	int32_t dims[7];
+	if ((fread(magic, sizeof(char), CUBECACHE_MAGIC_LENGTH, fp) != CUBECACHE_MAGIC_LENGTH) || strncmp(magic, CUBECACHE_MAGIC, CUBECACHE_MAGIC_LENGTH) || (fread(dims, sizeof(int32_t), 7, fp) != 7)){
+		fprintf(stderr, "Not a cube cache file: %s\n", filename);
+		exit(1);
+	}
+
+	//blocks are read where they are needed, read-ahead would mostly fetch blocks of other bands
+	posix_fadvise(fileno(fp), 0, 0, POSIX_FADV_RANDOM);
+
+	CubeCache *cache = new CubeCache;
+	cache->fp = fp;
+	cache->header.lines = dims[0];
+	cache->header.samples = dims[1];
+	cache->header.bands = dims[2];
+	cache->header.datatype = dims[3];
+	cache->header.offset = 0;
+	cache->blockLines = dims[4];
+	cache->blockSamples = dims[5];
+	cache->blockBands = dims[6];
+	cache->numLineBlocks = (cache->header.lines + cache->blockLines - 1)/cache->blockLines;
+	cache->numSampleBlocks = (cache->header.samples + cache->blockSamples - 1)/cache->blockSamples;
+	cache->numBandBlocks = (cache->header.bands + cache->blockBands - 1)/cache->blockBands;
+	cache->decodedBytes = 0;
+	cache->useCounter = 0;
+	cache->reverseWalk = false;
+
+	//keep enough decoded blocks for reading all bands of a band block, and the spectra of the pixels within a block,
+	//without decoding the same blocks again
+	size_t bandBlockColumn = sizeof(float)*cache->header.lines*cache->header.samples*cache->blockBands;
+	size_t spectrumBlocks = sizeof(float)*cache->blockLines*cache->blockSamples*cache->numBandBlocks*cache->blockBands;
+	cache->maxDecodedBytes = min(bandBlockColumn + spectrumBlocks, CUBECACHE_DECODED_BYTES);
+
+	cache->header.wlens.resize(cache->header.bands);
+	int numBlocks = cache->numLineBlocks*cache->numSampleBlocks*cache->numBandBlocks;
+	cache->blockOffsets.resize(numBlocks+1);
+	if ((fread(&(cache->header.wlens[0]), sizeof(float), cache->header.bands, fp) != (size_t)cache->header.bands) || (fread(&(cache->blockOffsets[0]), sizeof(uint64_t), numBlocks+1, fp) != (size_t)(numBlocks+1))){
+		fprintf(stderr, "Cube cache file is truncated: %s\n", filename);
+		exit(1);
+	}
+
+	fprintf(stderr, "Extracted: lines=%d, samples=%d, bands=%d, blocks of %d lines, %d samples and %d bands\n", cache->header.lines, cache->header.samples, cache->header.bands, cache->blockLines, cache->blockSamples, cache->blockBands);
+	return cache;
+}
+
+void cubecache_close(CubeCache *cache){
+	fclose(cache->fp);
+	delete cache;
+}
+
+void cubecache_clear_decoded(CubeCache *cache){
+	cache->decoded.clear();
+	cache->decodedBytes = 0;
+}
+
+void cubecache_read_band(CubeCache *cache, ImageSubset subset, int band, float *bandImage){
+	int bandBlock = band/cache->blockBands;
+	int blockBand = band - bandBlock*cache->blockBands;
+	int numBlockBands = min(cache->blockBands, cache->header.bands - bandBlock*cache->blockBands);
+	int numSamples = subset.endSamp - subset.startSamp;
+	int startLineBlock = subset.startLine/cache->blockLines;
+	int endLineBlock = (subset.endLine - 1)/cache->blockLines;
+	int startSampleBlock = subset.startSamp/cache->blockSamples;
+	int endSampleBlock = (subset.endSamp - 1)/cache->blockSamples;
+
+	//walk the line blocks in alternating directions: if the band block does not fit in the decoded blocks, the blocks
+	//decoded last are still there for the next band, whereas a walk in the same direction would find them all evicted
+	int numLineBlocks = endLineBlock - startLineBlock + 1;
+	for (int n=0; n < numLineBlocks; n++){
+		int lb = cache->reverseWalk ? endLineBlock - n : startLineBlock + n;
+		int startLine = max(lb*cache->blockLines, subset.startLine);
+		int endLine = min((lb+1)*cache->blockLines, subset.endLine);
+
+		for (int sb=startSampleBlock; sb <= endSampleBlock; sb++){
+			float *block = cubecache_get_block(cache, lb, sb, bandBlock);
+
+			//copy the part of this block that is inside the subset
+			int blockSamples = min(cache->blockSamples, cache->header.samples - sb*cache->blockSamples);
+			int startSample = max(sb*cache->blockSamples, subset.startSamp);
+			int endSample = min(sb*cache->blockSamples + blockSamples, subset.endSamp);
+			for (int i=startLine; i < endLine; i++){
+				int blockLine = i - lb*cache->blockLines;
+				memcpy(bandImage + (size_t)(i - subset.startLine)*numSamples + (startSample - subset.startSamp), block + ((size_t)blockLine*numBlockBands + blockBand)*blockSamples + (startSample - sb*cache->blockSamples), sizeof(float)*(endSample - startSample));
+			}
+		}
+	}
+	cache->reverseWalk = !cache->reverseWalk;
+}
+
+void cubecache_read_spectrum(CubeCache *cache, ImageSubset subset, int line, int sample, float *spectrum){
+	line += subset.startLine;
+	sample += subset.startSamp;
+	int lineBlock = line/cache->blockLines;
+	int blockLine = line - lineBlock*cache->blockLines;
+	int sampleBlock = sample/cache->blockSamples;
+	int blockSample = sample - sampleBlock*cache->blockSamples;
+	int blockSamples = min(cache->blockSamples, cache->header.samples - sampleBlock*cache->blockSamples);
+
+	for (int bb=0; bb < cache->numBandBlocks; bb++){
+		float *block = cubecache_get_block(cache, lineBlock, sampleBlock, bb);
+		int numBlockBands = min(cache->blockBands, cache->header.bands - bb*cache->blockBands);
+		for (int k=0; k < numBlockBands; k++){
+			spectrum[bb*cache->blockBands + k] = block[((size_t)blockLine*numBlockBands + k)*blockSamples + blockSample];
+		}
+	}
+}
+
+size_t cubecache_block_values(CubeCache *cache, int lineBlock, int sampleBlock, int bandBlock){
+	int numLines = min(cache->blockLines, cache->header.lines - lineBlock*cache->blockLines);
+	int numSamples = min(cache->blockSamples, cache->header.samples - sampleBlock*cache->blockSamples);
+	int numBands = min(cache->blockBands, cache->header.bands - bandBlock*cache->blockBands);
+	return (size_t)numLines*numSamples*numBands;
+}
+
+float *cubecache_get_block(CubeCache *cache, int lineBlock, int sampleBlock, int bandBlock){
+	int index = (lineBlock*cache->numSampleBlocks + sampleBlock)*cache->numBandBlocks + bandBlock;
+	cache->useCounter++;
+
+	//already decoded
+	map<int, CubeCacheBlock>::iterator decoded = cache->decoded.find(index);
+	if (decoded != cache->decoded.end()){
+		decoded->second.lastUse = cache->useCounter;
+		return &(decoded->second.values[0]);
+	}
+
+	//make room by removing least recently used blocks
+	size_t numValues = cubecache_block_values(cache, lineBlock, sampleBlock, bandBlock);
+	cache->decodedBytes += numValues*sizeof(float);
+	while ((cache->decodedBytes > cache->maxDecodedBytes) && (cache->decoded.size() > 0)){
+		map<int, CubeCacheBlock>::iterator oldest = cache->decoded.begin();
+		for (map<int, CubeCacheBlock>::iterator block = cache->decoded.begin(); block != cache->decoded.end(); block++){
+			if (block->second.lastUse < oldest->second.lastUse){
+				oldest = block;
+			}
+		}
+		cache->decodedBytes -= oldest->second.values.size()*sizeof(float);
+		cache->decoded.erase(oldest);
+	}
+
+	//read and decode block
+	size_t encodedBytes = cache->blockOffsets[index+1] - cache->blockOffsets[index];
+	unsigned char *encoded = (unsigned char*)malloc(encodedBytes + CUBECACHE_DECODE_PADDING);
+	fseeko(cache->fp, cache->blockOffsets[index], SEEK_SET);
+	if (fread(encoded, sizeof(unsigned char), encodedBytes, cache->fp) != encodedBytes){
+		fprintf(stderr, "Could not read block %d from cube cache file: %d, %d\n", index, ferror(cache->fp), feof(cache->fp));
+		exit(1);
+	}
+
+	CubeCacheBlock *newBlock = &(cache->decoded[index]);
+	newBlock->lastUse = cache->useCounter;
+	newBlock->values.resize(numValues);
+	int blockSamples = min(cache->blockSamples, cache->header.samples - sampleBlock*cache->blockSamples);
+	if (encodedBytes == numValues*cubecache_raw_value_bytes(cache->header.datatype)){
+		cubecache_load_raw(encoded, numValues, cache->header.datatype, &(newBlock->values[0]));
+	} else {
+		cubecache_decode(encoded, numValues, blockSamples, cache->header.datatype, &(newBlock->values[0]));
+	}
+	free(encoded);
+
+	return &(newBlock->values[0]);
+}
+
+//residual of a value against the previous value in the row
+inline uint32_t cubecache_residual(float val, float prev, int datatype){
+	if (datatype == 12){
+		int32_t delta = (int32_t)val - (int32_t)prev;
+		return ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31); //zigzag, small negative numbers become small positive numbers
+	} else {
+		//bit patterns of floats with the same sign are ordered like the values, close values give small differences
+		uint32_t valBits, prevBits;
+		memcpy(&valBits, &val, sizeof(float));
+		memcpy(&prevBits, &prev, sizeof(float));
+		int32_t delta = (int32_t)(valBits - prevBits);
+		return ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+	}
+}
+
+void cubecache_encode(float *values, size_t numValues, int samples, int datatype, vector<unsigned char> *encoded){
+	//residuals along each row. Blocks are only a few samples wide, so the first value of a row is taken against the
+	//first value of the previous row (the neighbouring band) rather than 0, except in the first row of the block.
+	size_t numGroups = (numValues + CUBECACHE_GROUP_SIZE - 1)/CUBECACHE_GROUP_SIZE;
+	vector<uint32_t> residuals(numGroups*CUBECACHE_GROUP_SIZE, 0);
+	for (size_t rowStart=0; rowStart < numValues; rowStart += samples){
+		float prev = (rowStart > 0) ? values[rowStart - samples] : 0.0f;
+		for (size_t i=rowStart; i < rowStart + samples; i++){
+			residuals[i] = cubecache_residual(values[i], prev, datatype);
+			prev = values[i];
+		}
+	}
+
+	for (size_t i=0; i < residuals.size(); i += CUBECACHE_GROUP_SIZE){
+		//bit width of this group
+		uint32_t bitsSet = 0;
+		for (int j=0; j < CUBECACHE_GROUP_SIZE; j++){
+			bitsSet |= residuals[i + j];
+		}
+		int width = 0;
+		while ((width < 32) && (bitsSet >> width)){
+			width++;
+		}
+		encoded->push_back(width);
+
+		//pack residuals, 16 values of width bits always end on a byte boundary
+		uint64_t accumulator = 0;
+		int accumulatedBits = 0;
+		for (int j=0; j < CUBECACHE_GROUP_SIZE; j++){
+			accumulator |= ((uint64_t)residuals[i + j]) << accumulatedBits;
+			accumulatedBits += width;
+			while (accumulatedBits >= 8){
+				encoded->push_back(accumulator & 0xff);
+				accumulator >>= 8;
+				accumulatedBits -= 8;
+			}
+		}
+	}
+}
+
+void cubecache_decode(unsigned char *encoded, size_t numValues, int samples, int datatype, float *values){
+	//unpack residuals. The values of a group are independent of each other: each is taken from a 64-bit load at the
+	//byte it starts in, which may read up to CUBECACHE_DECODE_PADDING bytes past the end of the encoded block.
+	size_t numGroups = (numValues + CUBECACHE_GROUP_SIZE - 1)/CUBECACHE_GROUP_SIZE;
+	vector<uint32_t> residuals(numGroups*CUBECACHE_GROUP_SIZE);
+	for (size_t i=0; i < residuals.size(); i += CUBECACHE_GROUP_SIZE){
+		int width = *(encoded++);
+		uint64_t mask = (1ull << width) - 1;
+		for (int j=0; j < CUBECACHE_GROUP_SIZE; j++){
+			int bit = j*width;
+			uint64_t word;
+			memcpy(&word, encoded + bit/8, sizeof(uint64_t));
+			#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			word = __builtin_bswap64(word); //bytes are packed starting from the least significant bits
+			#endif
+			residuals[i + j] = (word >> (bit % 8)) & mask;
+		}
+		encoded += 2*width;
+	}
+
+	//undo the residuals row by row, as in cubecache_encode. The running value is kept as an integer or a bit pattern,
+	//so that the chain of dependent operations along the row does not go through float conversions.
+	for (size_t rowStart=0; rowStart < numValues; rowStart += samples){
+		if (datatype == 12){
+			int32_t prev = (rowStart > 0) ? (int32_t)values[rowStart - samples] : 0;
+			for (size_t i=rowStart; i < rowStart + samples; i++){
+				prev += (int32_t)(residuals[i] >> 1) ^ -(int32_t)(residuals[i] & 1);
+				values[i] = prev;
+			}
+		} else {
+			uint32_t prevBits = 0;
+			if (rowStart > 0){
+				memcpy(&prevBits, &values[rowStart - samples], sizeof(float));
+			}
+			for (size_t i=rowStart; i < rowStart + samples; i++){
+				prevBits += (uint32_t)((int32_t)(residuals[i] >> 1) ^ -(int32_t)(residuals[i] & 1));
+				memcpy(&values[i], &prevBits, sizeof(float));
+			}
+		}
+	}
+}
+
+void cubecache_store_raw(float *values, size_t numValues, int datatype, vector<unsigned char> *encoded){
+	size_t valueBytes = cubecache_raw_value_bytes(datatype);
+	encoded->resize(numValues*valueBytes);
+	if (datatype == 12){
+		for (size_t i=0; i < numValues; i++){
+			uint16_t value = values[i];
+			memcpy(&((*encoded)[i*valueBytes]), &value, valueBytes);
+		}
+	} else {
+		memcpy(&((*encoded)[0]), values, numValues*valueBytes);
+	}
+}
+
+void cubecache_load_raw(unsigned char *encoded, size_t numValues, int datatype, float *values){
+	if (datatype == 12){
+		for (size_t i=0; i < numValues; i++){
+			uint16_t value;
+			memcpy(&value, encoded + i*sizeof(uint16_t), sizeof(uint16_t));
+			values[i] = value;
+		}
+	} else {
+		memcpy(values, encoded, numValues*sizeof(float));
+	}
+}
@@ -0,0 +1,84 @@
+//=======================================================================================================
+// Copyright 2015 Asgeir Bjorgan, Lise Lyngsnes Randeberg, Norwegian University of Science and Technology
+// Distributed under the MIT License.
+// (See accompanying file LICENSE or copy at
+// http://opensource.org/licenses/MIT)
+//=======================================================================================================
+
+#ifndef CUBECACHE_H_DEFINED
+#define CUBECACHE_H_DEFINED
+#include "readimage.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <map>
+
+//Chunked, compressed hyperspectral datacube (.hyc).
+//
+//The cube is split into blocks of blockLines lines x blockSamples samples x blockBands bands. Each block is compressed
+//independently and located through an index of file offsets, so that a band image or a pixel spectrum
+//can be read by decompressing only the blocks it touches.
+//
+//File layout (native byte order):
+// - magic "HYCUBE02"
+// - int32: lines, samples, bands, datatype, blockLines, blockSamples, blockBands
+// - float32[bands]: wavelengths
+// - uint64[numBlocks+1]: file offset of each block, last entry marks the end of the last block
+// - compressed blocks, ordered by line block, then sample block, then band block
+//
+//Within a block, each row (one line of one band, BIL-ordered) is delta coded along the samples, its first value
+//against the first value of the previous row, as zigzagged differences: of the values for integer data (datatype 12),
+//of the bit patterns read as integers for float data (datatype 4). The residuals are bit-packed in groups of 16, each
+//group prefixed by a byte giving the number of bits per value.
+//Blocks that do not get smaller this way are stored as they are in the image file (uint16 or float32, BIL-ordered),
+//recognized by their size being exactly that of the raw values. The coding is lossless.
+
+//upper limit for the size of decoded blocks kept in memory
+const size_t CUBECACHE_DECODED_BYTES = 256*1024*1024;
+
+//decoded block kept in memory
+typedef struct {
+	std::vector<float> values;
+	long lastUse;
+} CubeCacheBlock;
+
+typedef struct {
+	FILE *fp;
+	HyspexHeader header;
+	int blockLines;
+	int blockSamples;
+	int blockBands;
+	int numLineBlocks;
+	int numSampleBlocks;
+	int numBandBlocks;
+	std::vector<uint64_t> blockOffsets;
+
+	//recently decoded blocks by block index, least recently used are thrown out when exceeding maxDecodedBytes. Set by cubecache_open()
+	//to what is needed for browsing the bands of a band block and spectra, at most CUBECACHE_DECODED_BYTES. Users can lower it to fit a memory budget.
+	std::map<int, CubeCacheBlock> decoded;
+	size_t decodedBytes;
+	size_t maxDecodedBytes;
+	long useCounter;
+	bool reverseWalk; //direction of the next walk over the line blocks in cubecache_read_band()
+} CubeCache;
+
+//convert ENVI image to cube cache file
+void cubecache_convert(char *imageFilename, const char *cacheFilename, int blockLines, int blockSamples, int blockBands);
+
+//open cube cache file, read header and block index. Blocks are read on demand.
+CubeCache *cubecache_open(const char *filename);
+void cubecache_close(CubeCache *cache);
+
+//free all decoded blocks
+void cubecache_clear_decoded(CubeCache *cache);
+
+//read band image of size (subset lines)x(subset samples) into bandImage
+void cubecache_read_band(CubeCache *cache, ImageSubset subset, int band, float *bandImage);
+
+//read spectrum at (line, sample) relative to the subset into spectrum (size: bands)
+void cubecache_read_spectrum(CubeCache *cache, ImageSubset subset, int line, int sample, float *spectrum);
+
+//check whether filename has the cube cache extension (.hyc)
+bool cubecache_is_cache_file(const char *filename);
+
+#endif
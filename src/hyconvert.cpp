@@ -0,0 +1,74 @@
+//=======================================================================================================
+// Copyright 2015 Asgeir Bjorgan, Lise Lyngsnes Randeberg, Norwegian University of Science and Technology
+// Distributed under the MIT License.
+// (See accompanying file LICENSE or copy at
+// http://opensource.org/licenses/MIT)
+//=======================================================================================================
+
+#include "getopt.h"
+#include "cubecache.h"
+#include <stdlib.h>
+#include <iostream>
+using namespace std;
+
+void showHelp(){
+	cerr << "Usage: hyconvert [OPTION]... [IMAGEFILE] [CACHEFILE]" << endl
+		<< "Convert BIL-interleaved ENVI image to chunked, compressed cube cache file (.hyc), readable by hyview." << endl << endl
+		<< "--help\t\t\t Show help" << endl
+		<< "--block-lines=LINES \t Number of lines in each block (default: 64)" << endl
+		<< "--block-samples=SAMPLES  Number of samples in each block (default: 64)" << endl
+		<< "--block-bands=BANDS \t Number of bands in each block (default: 1)" << endl;
+}
+
+int main(int argc, char *argv[]){
+	option longopts[] = {
+		{"block-lines", required_argument, NULL, 0},
+		{"block-bands", required_argument, NULL, 1},
+		{"block-samples", required_argument, NULL, 3},
+		{"help", no_argument, NULL, 2},
+		{0, 0, 0, 0}
+	};
+
+	int blockLines = 64;
+	int blockSamples = 64;
+	int blockBands = 1;
+
+	int index;
+	while (true){
+		int flag = getopt_long(argc, argv, "", longopts, &index);
+		switch (flag){
+			case 0:
+				blockLines = strtod(optarg, NULL);
+			break;
+
+			case 1:
+				blockBands = strtod(optarg, NULL);
+			break;
+
+			case 2: //help
+				showHelp();
+				exit(0);
+			break;
+
+			case 3:
+				blockSamples = strtod(optarg, NULL);
+			break;
+		}
+		if (flag == -1){
+			break;
+		}
+	}
+
+	if ((argc - optind < 2) || (blockLines < 1) || (blockSamples < 1) || (blockBands < 1)){
+		showHelp();
+		exit(1);
+	}
+	char *imageFilename = argv[optind];
+	char *cacheFilename = argv[optind+1];
+	if (!cubecache_is_cache_file(cacheFilename)){
+		cerr << "Cube cache filename should end with .hyc: " << cacheFilename << endl;
+		exit(1);
+	}
+
+	cubecache_convert(imageFilename, cacheFilename, blockLines, blockSamples, blockBands);
+}
@@ -0,0 +1,47 @@
+//=======================================================================================================
+// Copyright 2015 Asgeir Bjorgan, Lise Lyngsnes Randeberg, Norwegian University of Science and Technology
+// Distributed under the MIT License.
+// (See accompanying file LICENSE or copy at
+// http://opensource.org/licenses/MIT)
+//=======================================================================================================
+
+#include "imageLoader.h"
+using namespace std;
+
+//number of lines read in between each signal to the image viewer. Kept small and independent of the image size, so that the first lines appear quickly.
+const int LOADER_CHUNK_LINES = 32;
+
+ImageLoader::ImageLoader(string filename, HyspexHeader header, CubeOptions options, float *data, QObject *parent) : QThread(parent), filename(filename), header(header), options(options), data(data){
+}
+
+void ImageLoader::run(){
+	ImageSubset subset = getCubeSubset(options, header);
+	SpectralResampling resampling;
+	bool resample = getCubeResampling(options, header, &resampling);
+
+	//calibration images can be as large as the image itself, read them here rather than in the UI thread
+	RadiometricCalibration calibration;
+	bool calibrate = getCubeCalibration(options, header, &calibration);
+
+	int numLines = subset.endLine - subset.startLine;
+	int numSamples = subset.endSamp - subset.startSamp;
+	int numBands = resample ? resampling.wlens.size() : header.bands;
+
+	//take the page faults of the datacube here rather than when the UI thread allocates it
+	if (options.populate){
+		hyperspectral_populate_image(data, (size_t)numLines*numSamples*numBands);
+	}
+
+	for (int i=0; (i < numLines) && !isInterruptionRequested(); i += LOADER_CHUNK_LINES){
+		//read the next chunk of lines into its place in the datacube
+		ImageSubset chunk = subset;
+		chunk.startLine = subset.startLine + i;
+		chunk.endLine = chunk.startLine + LOADER_CHUNK_LINES;
+		if (chunk.endLine > subset.endLine){
+			chunk.endLine = subset.endLine;
+		}
+		hyperspectral_read_image(&filename[0], &header, chunk, data + (size_t)i*numSamples*numBands, resample ? &resampling : NULL, calibrate ? &calibration : NULL);
+
+		emit linesLoaded(chunk.endLine - subset.startLine);
+	}
+}
@@ -0,0 +1,34 @@
+//=======================================================================================================
+// Copyright 2015 Asgeir Bjorgan, Lise Lyngsnes Randeberg, Norwegian University of Science and Technology
+// Distributed under the MIT License.
+// (See accompanying file LICENSE or copy at
+// http://opensource.org/licenses/MIT)
+//=======================================================================================================
+
+
+#ifndef IMAGELOADER_H_DEFINED
+#define IMAGELOADER_H_DEFINED
+
+#include <QThread>
+#include <string>
+#include "readimage.h"
+#include "cubeSession.h"
+
+//Reads a hyperspectral image in the background, chunk by chunk, and signals how many lines are available so far.
+//Lines are written to the provided float array in the same layout as hyperspectral_read_image, with the subset, resampling and calibration given by the options.
+class ImageLoader : public QThread{
+	Q_OBJECT
+	public:
+		ImageLoader(std::string filename, HyspexHeader header, CubeOptions options, float *data, QObject *parent = NULL);
+	signals:
+		void linesLoaded(int numLines); //lines 0, ..., numLines-1 of the subset are now in the float array
+	protected:
+		void run();
+	private:
+		std::string filename;
+		HyspexHeader header;
+		CubeOptions options;
+		float *data;
+};
+
+#endif
@@ -14,22 +14,95 @@
 #include <QEvent>
 #include <QPainter>
 #include <QMouseEvent>
+#include <QProgressBar>
+#include <QTimer>
+#include <QCheckBox>
 #include <iostream>
+#include <map>
+#include <cstring>
+#include <algorithm>
 using namespace std;
 
-
-bool isValidValue(float val){
-	return (0*val == 0*val); //should check for both Inf and NaN. Not sure if platform independent.
-}
-
 /////////////////
 // ImageViewer //
 /////////////////
 
-ImageViewer::ImageViewer(float *data, int lines, int samples, int bands, vector<float> wlens, QWidget *parent) : data(data), lines(lines), samples(samples), bands(bands), wlens(wlens), QWidget(parent){
-	currImgData = new uchar[samples*lines*3];
+//minimum time between redraws while the image is being loaded (ms)
+const int LOADING_REFRESH_INTERVAL = 100;
+
+//minimum time between hover spectrum updates, mouse movements in between are coalesced (ms). Approximately the display refresh rate.
+const int HOVER_REFRESH_INTERVAL = 16;
+
+//width and height of the pixel-major tiles in the spectral cache
+const int SPECTRAL_TILE_SIZE = 32;
+
+//memory manager ids of spectral cache tiles, negative to avoid collision with the band numbers used for rendered band images
+int spectralTileId(int tile){
+	return -1 - tile;
+}
+
+ImageViewer::ImageViewer(float *data, int lines, int samples, int bands, vector<float> wlens, int loadedLines, MemoryManager *memoryManager, QWidget *parent) : QWidget(parent), data(data), lines(lines), samples(samples), bands(bands), wlens(wlens), loadedLines(loadedLines), cache(NULL), bandData(NULL), memoryManager(memoryManager), spectralCacheEnabled(false){
+	if (loadedLines < 0){
+		this->loadedLines = lines;
+	}
+	init();
+}
+
+ImageViewer::ImageViewer(CubeCache *cache, ImageSubset subset, MemoryManager *memoryManager, QWidget *parent) : QWidget(parent), data(NULL), lines(subset.endLine - subset.startLine), samples(subset.endSamp - subset.startSamp), bands(cache->header.bands), wlens(cache->header.wlens), cache(cache), cacheSubset(subset), memoryManager(memoryManager), spectralCacheEnabled(false){
+	//all lines are available, bands are decompressed on demand
+	loadedLines = lines;
+	bandData = new float[(size_t)lines*samples];
+	init();
+}
+
+ImageViewer::~ImageViewer(){
+	//remove hover spectrum of this image
+	emit hoveredPixel(0, 0, NULL, NULL, 0);
+
+	if (memoryManager != NULL){
+		memoryManager->releaseAll(this);
+	}
+	for (map<int, uchar*>::iterator it = renderedBands.begin(); it != renderedBands.end(); it++){
+		delete [] it->second;
+	}
+	for (map<int, float*>::iterator it = spectralTiles.begin(); it != spectralTiles.end(); it++){
+		delete [] it->second;
+	}
+	delete [] currImgData;
+	delete [] bandData;
+}
+
+void ImageViewer::init(){
+	currBand = -1;
+	currImgData = new uchar[(size_t)samples*lines];
 	imageLabel = new QLabel;
 
+	//loading progress
+	progressBar = new QProgressBar;
+	progressBar->setRange(0, lines);
+	progressBar->setValue(this->loadedLines);
+	progressBar->setVisible(this->loadedLines < lines);
+
+	refreshTimer = new QTimer(this);
+	refreshTimer->setSingleShot(true);
+	refreshTimer->setInterval(LOADING_REFRESH_INTERVAL);
+	connect(refreshTimer, SIGNAL(timeout()), SLOT(refreshImage()));
+
+	//hover spectrum
+	spectrumBuffer.resize(bands);
+	hoverWlens.resize(bands);
+	hoverSpectrum.resize(bands);
+	hoverMode = false;
+	hoverLine = -1;
+	hoverSample = -1;
+	hoverTimer = new QTimer(this);
+	hoverTimer->setSingleShot(true);
+	hoverTimer->setInterval(HOVER_REFRESH_INTERVAL);
+	connect(hoverTimer, SIGNAL(timeout()), SLOT(updateHoverSpectrum()));
+
+	QCheckBox *hoverChooser = new QCheckBox("Display spectrum under cursor");
+	connect(hoverChooser, SIGNAL(toggled(bool)), SLOT(setHoverMode(bool)));
+
 	//scrollbar for choosing band
 	QScrollBar *bandChooser = new QScrollBar;
 	bandChooser->setMaximum(bands-1);
@@ -41,6 +114,8 @@ ImageViewer::ImageViewer(float *data, int lines, int samples, int bands, vector<
 	updateImage(0);
 	QScrollArea *area = new QScrollArea;
 	layout->addWidget(area, 0, 0);
+	layout->addWidget(progressBar, 1, 0, 1, 2);
+	layout->addWidget(hoverChooser, 2, 0, 1, 2);
 
 	imageLabel->setBackgroundRole(QPalette::Base);
 	imageLabel->setSizePolicy(QSizePolicy::Ignored, QSizePolicy::Ignored);
@@ -51,15 +126,15 @@ ImageViewer::ImageViewer(float *data, int lines, int samples, int bands, vector<
 	imageLabel->installEventFilter(this);
 
 	bandChooser->setValue(0);
+}
 
-	//plot displayer, if compiled with support for this
-	#ifdef WITH_QWT
-	SpectrumDisplayer *spectrumDisplayer = new SpectrumDisplayer;
+#ifdef WITH_QWT
+void ImageViewer::connectSpectrumDisplayer(SpectrumDisplayer *spectrumDisplayer){
 	connect(this, SIGNAL(clickedPixel(int, int, QVector<double>, QVector<double>, KeepMode)), spectrumDisplayer, SLOT(displaySpectrum(int, int, QVector<double>, QVector<double>, KeepMode)));
 	connect(this, SIGNAL(newBand(float)), spectrumDisplayer, SLOT(setVerticalLine(float)));
-	spectrumDisplayer->show();
-	#endif
+	connect(this, SIGNAL(hoveredPixel(int, int, const double*, const double*, int)), spectrumDisplayer, SLOT(displayHoverSpectrum(int, int, const double*, const double*, int)));
 }
+#endif
 
 
 
@@ -85,75 +160,177 @@ void ImageViewer::paintEvent(QPaintEvent *evt){
 }
 
 void ImageViewer::getSpectrum(int x, int y, float *spec){
+	if (cache != NULL){
+		cubecache_read_spectrum(cache, cacheSubset, y, x, spec);
+		return;
+	}
+
+	//one contiguous read from the pixel-major tile, if available
+	float *tile = getSpectralTile(y/SPECTRAL_TILE_SIZE, x/SPECTRAL_TILE_SIZE);
+	if (tile != NULL){
+		int tileWidth = min(SPECTRAL_TILE_SIZE, samples - (x/SPECTRAL_TILE_SIZE)*SPECTRAL_TILE_SIZE);
+		int tileLine = y % SPECTRAL_TILE_SIZE;
+		int tileSample = x % SPECTRAL_TILE_SIZE;
+		memcpy(spec, tile + (tileLine*tileWidth + tileSample)*bands, sizeof(float)*bands);
+		return;
+	}
+
 	for (int i=0; i < bands; i++){
-		spec[i] = data[y*samples*bands + i*samples + x];
+		spec[i] = data[(size_t)y*samples*bands + (size_t)i*samples + x];
 	}
 }
 
-void ImageViewer::updateImage(int band){
-	int c = 0;
-	float *imgDataTmp = new float[lines*samples*3]();
-	double std = 0, mean = 0;
-	long n = 0;
-
-	float max = -1000;
-	float min = +1000;
-
-
-	//convert to greyscale array
-	for (int i=0; i < lines; i++){
-		for (int j=0; j < samples; j++){
-			float val = data[i*samples*bands + band*samples + j];
-			if (isValidValue(val)){ //check for NaN and Inf, in case the input image is sketchy
-				n++;
-				double delta = val - mean;
-				mean = mean + delta/(1.0f*n);
-				std = std + delta*(val - mean);
-			} else {
-				val = 0;
-			}
-			imgDataTmp[c++] = val;
-			imgDataTmp[c++] = val;
-			imgDataTmp[c++] = val;
-			if (val > max){
-				max = val;
-			}
-			if (val < min){
-				min = val;
+void ImageViewer::setSpectralCache(bool enabled){
+	spectralCacheEnabled = enabled;
+}
+
+float *ImageViewer::getSpectralTile(int tileRow, int tileCol){
+	if (!spectralCacheEnabled || (memoryManager == NULL)){
+		return NULL;
+	}
+	int numTileCols = (samples + SPECTRAL_TILE_SIZE - 1)/SPECTRAL_TILE_SIZE;
+	int tile = tileRow*numTileCols + tileCol;
+
+	map<int, float*>::iterator cached = spectralTiles.find(tile);
+	if (cached != spectralTiles.end()){
+		memoryManager->touch(this, spectralTileId(tile));
+		return cached->second;
+	}
+
+	int startLine = tileRow*SPECTRAL_TILE_SIZE;
+	int endLine = min(startLine + SPECTRAL_TILE_SIZE, lines);
+	int startSample = tileCol*SPECTRAL_TILE_SIZE;
+	int tileWidth = min(SPECTRAL_TILE_SIZE, samples - startSample);
+	if (endLine > loadedLines){
+		//tile is not completely loaded yet
+		return NULL;
+	}
+
+	//transpose tile from BIL to BIP
+	memoryManager->reserve(this, spectralTileId(tile), sizeof(float)*(endLine - startLine)*tileWidth*bands);
+	float *tileData = new float[(endLine - startLine)*tileWidth*bands];
+	for (int i=startLine; i < endLine; i++){
+		for (int k=0; k < bands; k++){
+			float *bandLine = data + (size_t)i*samples*bands + (size_t)k*samples + startSample;
+			for (int j=0; j < tileWidth; j++){
+				tileData[((i - startLine)*tileWidth + j)*bands + k] = bandLine[j];
 			}
 		}
 	}
-	std = sqrt(std/(n-1));
+	spectralTiles[tile] = tileData;
+	return tileData;
+}
 
-	if (isValidValue(mean)){
-		//mean is well-defined, define new min and max from dynamic ranges
-		max = mean + 2*std;
-		min = mean - 2*std;
+void ImageViewer::updateImage(int band){
+	//previously displayed band can now be evicted
+	if ((memoryManager != NULL) && (currBand != band)){
+		memoryManager->setPinned(this, currBand, false);
 	}
+	currBand = band;
 
+	//signal that the wavelength has changed
+	if (band < (int)wlens.size()){
+		emit newBand(wlens[band]);
+	}
 
+	//reuse rendered band image if available
+	map<int, uchar*>::iterator rendered = renderedBands.find(band);
+	if (rendered != renderedBands.end()){
+		memoryManager->setPinned(this, band, true);
+		currImage = QImage(rendered->second, samples, lines, samples, QImage::Format_Grayscale8);
+		update();
+		return;
+	}
 
-	//convert to positive values, divide by largest value
-	for (int i=0; i < lines*samples*3; i++){
-		if (imgDataTmp[i] > (mean + 2*std)){
-			imgDataTmp[i] = max;
-		}
-		if (imgDataTmp[i] < (mean - 2*std)){
-			imgDataTmp[i] = min;
+	if (cache != NULL){
+		//decompress band into temporary band image
+		cubecache_read_band(cache, cacheSubset, band, bandData);
+	}
+
+	//restart band statistics
+	statLines = 0;
+	band_statistics_reset(&stats);
+
+	accumulateStatistics();
+	renderImage();
+}
+
+void ImageViewer::evictMemory(int id){
+	if (id < 0){
+		//spectral cache tile
+		map<int, float*>::iterator tile = spectralTiles.find(-1 - id);
+		if (tile != spectralTiles.end()){
+			delete [] tile->second;
+			spectralTiles.erase(tile);
 		}
-		currImgData[i] = (uchar)((imgDataTmp[i] - min)/(max - min)*255);
+		return;
 	}
 
+	map<int, uchar*>::iterator rendered = renderedBands.find(id);
+	if (rendered != renderedBands.end()){
+		delete [] rendered->second;
+		renderedBands.erase(rendered);
+	}
+}
 
-	currImage = QImage(currImgData, samples, lines, 3*samples, QImage::Format_RGB888);
-	update();
+void ImageViewer::setLoadedLines(int numLines){
+	loadedLines = numLines;
+	progressBar->setValue(numLines);
+	progressBar->setVisible(numLines < lines);
+
+	//redraw immediately when the first lines or the last lines arrive, otherwise at most every LOADING_REFRESH_INTERVAL ms
+	if ((statLines == 0) || (numLines == lines)){
+		refreshTimer->stop();
+		refreshImage();
+	} else if (!refreshTimer->isActive()){
+		refreshTimer->start();
+	}
+}
 
-	delete [] imgDataTmp;
+float *ImageViewer::getBandLine(int line){
+	if (cache != NULL){
+		return bandData + (size_t)line*samples;
+	}
+	return data + (size_t)line*samples*bands + (size_t)currBand*samples;
+}
 
-	//signal that the wavelength has changed
-	if (band < wlens.size()){
-		emit newBand(wlens[band]);
+void ImageViewer::refreshImage(){
+	accumulateStatistics();
+	renderImage();
+}
+
+void ImageViewer::accumulateStatistics(){
+	//running mean and variance (Welford), only over the lines that have arrived since the last update
+	for (int i=statLines; i < loadedLines; i++){
+		band_statistics_accumulate(&stats, getBandLine(i), samples);
 	}
+	statLines = loadedLines;
+}
+
+void ImageViewer::renderImage(){
+	float min, max;
+	band_statistics_range(&stats, &min, &max);
+
+	//completely loaded bands are rendered to a separate buffer and kept for later as long as the memory manager allows
+	uchar *imgData = currImgData;
+	if ((memoryManager != NULL) && (statLines == lines)){
+		if (renderedBands.find(currBand) == renderedBands.end()){
+			memoryManager->reserve(this, currBand, (size_t)samples*lines, true);
+			renderedBands[currBand] = new uchar[(size_t)samples*lines];
+		} else {
+			memoryManager->setPinned(this, currBand, true);
+		}
+		imgData = renderedBands[currBand];
+	}
+
+	//convert to greyscale array, clamp to dynamic range. Lines not yet loaded are left black.
+	for (int i=0; i < statLines; i++){
+		band_to_greyscale(getBandLine(i), samples, min, max, imgData + (size_t)i*samples);
+	}
+	memset(imgData + (size_t)statLines*samples, 0, (size_t)(lines - statLines)*samples);
+
+	currImage = QImage(imgData, samples, lines, samples, QImage::Format_Grayscale8);
+	update();
 }
 
 void ImageViewer::saveImage(int band, string bandimagename){
@@ -161,9 +338,46 @@ void ImageViewer::saveImage(int band, string bandimagename){
 	currImage.save(QString::fromStdString(bandimagename));
 }
 
+void ImageViewer::setHoverMode(bool enabled){
+	hoverMode = enabled;
+	if (!hoverMode){
+		//remove hover spectrum
+		hoverTimer->stop();
+		emit hoveredPixel(0, 0, NULL, NULL, 0);
+	}
+}
+
+void ImageViewer::updateHoverSpectrum(){
+	if (!hoverMode || (hoverLine < 0) || (hoverLine >= loadedLines) || (hoverSample < 0) || (hoverSample >= samples)){
+		return;
+	}
+	this->getSpectrum(hoverSample, hoverLine, &spectrumBuffer[0]);
+
+	//keep only valid values, the spectrum displayer copies them before the next hover
+	int numValues = 0;
+	for (int i=0; i < bands; i++){
+		if (isValidValue(spectrumBuffer[i])){
+			hoverWlens[numValues] = wlens[i];
+			hoverSpectrum[numValues] = spectrumBuffer[i];
+			numValues++;
+		}
+	}
+	emit hoveredPixel(hoverLine, hoverSample, &hoverWlens[0], &hoverSpectrum[0], numValues);
+}
+
 bool ImageViewer::eventFilter(QObject *object, QEvent *event){
 	Q_UNUSED(object);
 
+	//update hover spectrum on mouse movement, at most every HOVER_REFRESH_INTERVAL ms
+	if ((event->type() == QEvent::MouseMove) && hoverMode){
+		QMouseEvent *mouseEvent = static_cast<QMouseEvent*>(event);
+		hoverSample = widthScale*mouseEvent->x();
+		hoverLine = heightScale*mouseEvent->y();
+		if (!hoverTimer->isActive()){
+			hoverTimer->start();
+		}
+	}
+
 	//update displayed spectrum on mouse button press
 	if ((event->type() == QEvent::MouseButtonPress)){
 		QMouseEvent *mouseEvent = static_cast<QMouseEvent*>(event);
@@ -177,7 +391,11 @@ bool ImageViewer::eventFilter(QObject *object, QEvent *event){
 		//get spectrum in current position
 		int pixel = widthScale*mouseEvent->x();
 		int line = heightScale*mouseEvent->y();
-		float *spectrum = new float[bands];
+		if (line >= loadedLines){
+			//line has not been loaded yet
+			return false;
+		}
+		float *spectrum = &spectrumBuffer[0];
 		this->getSpectrum(pixel, line, spectrum);
 
 		//convert data to QVector and emit signal (to plot displayer, if compiled with support for this...)
@@ -191,7 +409,6 @@ bool ImageViewer::eventFilter(QObject *object, QEvent *event){
 		}
 
 		emit clickedPixel(line, pixel, wlens_vec, spectrum_vec, keepMode);
-		delete [] spectrum;
 	}
 	return false;
 }
@@ -229,6 +446,31 @@ SpectrumDisplayer::SpectrumDisplayer(QWidget *parent) : QWidget(parent){
 	vertLine = new QwtPlotMarker;
 	vertLine->setLineStyle(QwtPlotMarker::VLine);
 	vertLine->attach(plot);
+
+	//curve following the cursor, attached when there is something to display
+	hoverCurve = new QwtPlotCurve("Cursor");
+	hoverCurve->setPen(QColor(Qt::black));
+}
+
+void SpectrumDisplayer::displayHoverSpectrum(int y, int x, const double *wlens, const double *intensity, int size){
+	Q_UNUSED(y);
+	Q_UNUSED(x);
+	if (size == 0){
+		hoverCurve->detach();
+	} else {
+		//plot from own buffers, which are only reallocated when a spectrum gets longer than the previous ones
+		if (hoverWlens.size() < (size_t)size){
+			hoverWlens.resize(size);
+			hoverIntensity.resize(size);
+		}
+		copy(wlens, wlens + size, hoverWlens.begin());
+		copy(intensity, intensity + size, hoverIntensity.begin());
+		hoverCurve->setRawSamples(&hoverWlens[0], &hoverIntensity[0], size);
+		if (hoverCurve->plot() == NULL){
+			hoverCurve->attach(plot);
+		}
+	}
+	plot->replot();
 }
 
 void SpectrumDisplayer::displaySpectrum(int y, int x, QVector<double> wlens, QVector<double> intensity, KeepMode keepBehavior){
@@ -243,8 +485,9 @@ void SpectrumDisplayer::displaySpectrum(int y, int x, QVector<double> wlens, QVe
 
 	//remove previous spectra
 	if (keepBehavior == DELETE_PREVIOUS_SPECTRA){
-		for (int i=0; i < curves.size(); i++){
+		for (int i=0; i < (int)curves.size(); i++){
 			curves[i]->detach();
+			delete curves[i];
 		}
 		curves.clear();
 		colorCtr = 0;
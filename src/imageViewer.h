@@ -13,31 +13,88 @@
 #include <QVector>
 #include <string>
 #include <vector>
+#include <map>
+#include "cubecache.h"
+#include "memoryManager.h"
+#include "bandStatistics.h"
 
 class QLabel;
+class QProgressBar;
+class QTimer;
 
 //used in SpectrumDisplayer for controlling whether to keep or delete previous spectra in the plot when adding a new one
 enum KeepMode{KEEP_PREVIOUS_SPECTRA, DELETE_PREVIOUS_SPECTRA};
 
+#ifdef WITH_QWT
+class SpectrumDisplayer;
+#endif
+
 //Qt widget for displaying a hyperspectral datacube, using a QImage and a scrollbar for choosing band to display. 
-class ImageViewer : public QWidget{
+//Rendered band images are kept for reuse when a memory manager is provided, and evicted by it when exceeding the memory budget.
+class ImageViewer : public QWidget, public MemoryConsumer{
 	Q_OBJECT
 	public:
-		ImageViewer(float *data, int lines, int samples, int bands, std::vector<float> wlens, QWidget *parent = NULL); //assumes BIL-interleaved hyperspectral datacube in *data
+		ImageViewer(float *data, int lines, int samples, int bands, std::vector<float> wlens, int loadedLines = -1, MemoryManager *memoryManager = NULL, QWidget *parent = NULL); //assumes BIL-interleaved hyperspectral datacube in *data. loadedLines: number of lines already available in *data (-1: all)
+		ImageViewer(CubeCache *cache, ImageSubset subset, MemoryManager *memoryManager = NULL, QWidget *parent = NULL); //display image subset of a cube cache file, decompressing only the blocks needed for the current band or spectrum
+		~ImageViewer();
+		void evictMemory(int id); //free rendered image of the given band (id >= 0) or spectral cache tile (id < 0)
+		void setSpectralCache(bool enabled); //serve spectra from pixel-major (BIP) copies of the datacube, created tile by tile when first needed
+		#ifdef WITH_QWT
+		void connectSpectrumDisplayer(SpectrumDisplayer *spectrumDisplayer); //display clicked spectra and current wavelength in the given SpectrumDisplayer
+		#endif
 		void getSpectrum(int x, int y, float *spec); //copy spectrum at pixel (y,x) in provided float array
 	public slots:	
 		void updateImage(int band); //update displayed image to provided band. Uses dynamic ranges. 
 		void saveImage(int band, std::string bandimagename); //save the image at provided band to file (format specified by the filename)
+		void setHoverMode(bool enabled); //continuously emit the spectrum under the cursor
+		void setLoadedLines(int numLines); //lines 0, ..., numLines-1 contain valid data. Remaining lines are displayed as black and ignored in the band statistics until they arrive
+	private slots:
+		void refreshImage(); //refine band statistics using newly loaded lines and redraw the current band
+		void updateHoverSpectrum(); //emit spectrum at the latest cursor position
 	private:
+		void init(); //set up widgets, display first band
+		float *getBandLine(int line); //pointer to the given line of the current band
+		float *getSpectralTile(int tileRow, int tileCol); //pixel-major copy of the given tile, NULL if the spectral cache is disabled or the tile is not yet loaded
+		void accumulateStatistics(); //update band statistics with lines loaded since the last update
+		void renderImage(); //convert current band to greyscale image using current band statistics
+
 		//datacube information
 		float *data;
 		int lines;
 		int samples;
 		int bands;
 		std::vector<float> wlens;
+		int loadedLines; //number of lines currently available in *data
+
+		//alternatively, datacube contained in a cube cache file. Current band is decompressed to bandData.
+		CubeCache *cache;
+		ImageSubset cacheSubset;
+		float *bandData;
+
+		//running statistics of the currently displayed band, accumulated over lines 0, ..., statLines-1
+		int currBand;
+		int statLines;
+		BandStatistics stats;
+
+		QProgressBar *progressBar; //loading progress, hidden when all lines are available
+		QTimer *refreshTimer; //coalesces redraws while lines are being loaded
 
 		QImage currImage; //currently displayed image
-		uchar *currImgData; //image data of currently displayed image
+		uchar *currImgData; //image data of currently displayed image, while the image is still loading
+		MemoryManager *memoryManager;
+		std::map<int, uchar*> renderedBands; //image data of completely loaded bands, indexed by band number
+
+		bool spectralCacheEnabled;
+		std::map<int, float*> spectralTiles; //BIP-interleaved tiles of SPECTRAL_TILE_SIZE x SPECTRAL_TILE_SIZE pixels, indexed by tile number
+
+		//spectrum under the cursor, buffers reused between updates
+		bool hoverMode;
+		QTimer *hoverTimer; //coalesces mouse movements
+		int hoverLine;
+		int hoverSample;
+		std::vector<float> spectrumBuffer;
+		std::vector<double> hoverWlens;
+		std::vector<double> hoverSpectrum;
 		QLabel *imageLabel;
 		
 		//scaling factors of image when widget is physically resized
@@ -48,6 +105,7 @@ class ImageViewer : public QWidget{
 		bool eventFilter(QObject *object, QEvent *event); //mouse button clicks on image
 	signals:
 		void clickedPixel(int line, int sample, QVector<double> wlens, QVector<double> spectrum, KeepMode keepMode); //emit spectrum residing in clicked pixel
+		void hoveredPixel(int line, int sample, const double *wlens, const double *spectrum, int numValues); //emit spectrum under the cursor. Buffers are owned by the image viewer and overwritten on the next emit. numValues = 0: hover mode was switched off or the viewer is deleted
 		float newBand(float wavelength); //use for signalling current wavelength to e.g. SpectrumDisplayer
 
 };
@@ -66,10 +124,14 @@ class SpectrumDisplayer : public QWidget{
 	public slots:
 		void displaySpectrum(int y, int x, QVector<double> wlens, QVector<double> intensity, KeepMode keepBehavior);
 		void setVerticalLine(float wavelength); //set a vertical line at the specified wavelength
+		void displayHoverSpectrum(int y, int x, const double *wlens, const double *intensity, int size); //display spectrum under the cursor, copied to buffers reused between calls. Removed when size = 0
 	private:
 		QwtPlot *plot;
 		QVector<QwtPlotCurve*> curves; //current displayed data curves
 		QwtPlotMarker *vertLine; //vertical line for indicating current wavelength in the imageviewer
+		QwtPlotCurve *hoverCurve; //spectrum under the cursor
+		std::vector<double> hoverWlens; //plotted data of hoverCurve. Owned by the displayer, since it is shared between image viewers that can be deleted.
+		std::vector<double> hoverIntensity;
 		int colorCtr; //for choosing between colors to use in the displayed spectrum
 };
 #endif
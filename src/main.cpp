@@ -7,27 +7,44 @@
 
 
 #include <QApplication>
+#include <QCoreApplication>
 #include <string>
 #include "getopt.h"
 #include <sstream>
-#include "imageViewer.h"
-#include "readimage.h"
+#include "cubeSession.h"
+#include "renderServer.h"
+#include "memoryManager.h"
+#include <unistd.h>
 #include <vector>
 #include <iostream>
+#include <stdio.h>
+#include <math.h>
 using namespace std;
 
 void showHelp(){
-	cerr << "Usage: hyview [OPTION]... [FILE]" << endl
-		<< "Hyperspectral image viewer (BIL-interleaved ENVI image assumed)." << endl << endl
-		<< "--help\t\t\t Show help" << endl << endl
+	cerr << "Usage: hyview [OPTION]... [FILE]..." << endl
+		<< "Hyperspectral image viewer (BIL-interleaved ENVI image assumed). Several files are displayed in separate tabs." << endl << endl
+		<< "--help\t\t\t Show help" << endl
+		<< "--memory-budget=MB \t Memory used for datacubes and rendered band images before the least recently used are evicted (default: half of physical memory)" << endl
+		<< "--populate \t\t Fault in the memory of each datacube before loading it, instead of line by line while loading" << endl
+		<< "--spectral-cache \t Keep pixel-major copies of the parts of the image where spectra are displayed, for faster spectrum display under the cursor" << endl
+		<< "--serve[=SOCKET] \t Run without display, serving band images, spectra and region statistics on a local socket (default name: hyview). See README." << endl << endl
 		<< "Image subset arguments:" << endl
 		<< "--startpix=START_PIXEL \t Start pixel (chosen pixel for showpixel)" << endl
 		<< "--endpix=END_PIXEL \t End pixel" << endl
 		<< "--startline=START_LINE \t Start line (chosen line for showpixel)" << endl
-		<< "--endline=END_LINE \t End line" << endl;
+		<< "--endline=END_LINE \t End line" << endl << endl
+		<< "Spectral resampling arguments, applied while loading:" << endl
+		<< "--bin=BANDS \t\t Average each BANDS adjacent bands" << endl
+		<< "--resample=START:STEP:END \t Resample to wavelengths START, START+STEP, ..., END (nm)" << endl << endl
+		<< "Radiometric calibration arguments, applied while loading: (value - dark)*gain + offset." << endl
+		<< "ENVI images with the same number of samples and bands as the image, averaged over all lines:" << endl
+		<< "--dark=FILE \t\t Dark frame" << endl
+		<< "--gain=FILE \t\t Gain" << endl
+		<< "--offset=FILE \t\t Offset" << endl;
 }
 void createOptions(option **options){
-	int numOptions = 6;
+	int numOptions = 15;
 	*options = new option[numOptions];
 
 	(*options)[0].name = "startpix";
@@ -55,10 +72,55 @@ void createOptions(option **options){
 	(*options)[4].flag = NULL;
 	(*options)[4].val = 4;
 	
-	(*options)[5].name = 0;
-	(*options)[5].has_arg = 0;
-	(*options)[5].flag = 0;
-	(*options)[5].val = 0;
+	(*options)[5].name = "memory-budget";
+	(*options)[5].has_arg = required_argument;
+	(*options)[5].flag = NULL;
+	(*options)[5].val = 5;
+	
+	(*options)[6].name = "spectral-cache";
+	(*options)[6].has_arg = no_argument;
+	(*options)[6].flag = NULL;
+	(*options)[6].val = 6;
+	
+	(*options)[7].name = "bin";
+	(*options)[7].has_arg = required_argument;
+	(*options)[7].flag = NULL;
+	(*options)[7].val = 7;
+	
+	(*options)[8].name = "resample";
+	(*options)[8].has_arg = required_argument;
+	(*options)[8].flag = NULL;
+	(*options)[8].val = 8;
+	
+	(*options)[9].name = "populate";
+	(*options)[9].has_arg = no_argument;
+	(*options)[9].flag = NULL;
+	(*options)[9].val = 9;
+	
+	(*options)[10].name = "dark";
+	(*options)[10].has_arg = required_argument;
+	(*options)[10].flag = NULL;
+	(*options)[10].val = 10;
+	
+	(*options)[11].name = "gain";
+	(*options)[11].has_arg = required_argument;
+	(*options)[11].flag = NULL;
+	(*options)[11].val = 11;
+	
+	(*options)[12].name = "offset";
+	(*options)[12].has_arg = required_argument;
+	(*options)[12].flag = NULL;
+	(*options)[12].val = 12;
+	
+	(*options)[13].name = "serve";
+	(*options)[13].has_arg = optional_argument;
+	(*options)[13].flag = NULL;
+	(*options)[13].val = 13;
+	
+	(*options)[14].name = 0;
+	(*options)[14].has_arg = 0;
+	(*options)[14].flag = 0;
+	(*options)[14].val = 0;
 
 }
 
@@ -72,7 +134,15 @@ int main(int argc, char *argv[]){
 	int endline = 0;
 	int startpix = 0;
 	int endpix = 0;
-	int band = 0;
+	size_t memoryBudget = 0;
+	bool serve = false;
+	string socketName = "hyview";
+
+	CubeOptions options;
+	options.spectralCache = false;
+	options.binSize = 0;
+	options.populate = false;
+	float resampleStart, resampleStep, resampleEnd;
 
 	int index;
 	
@@ -99,55 +169,93 @@ int main(int argc, char *argv[]){
 			case 4: 
 				endline = strtod(optarg, NULL);
 			break;
+
+			case 5: 
+				memoryBudget = strtod(optarg, NULL);
+			break;
+
+			case 6: 
+				options.spectralCache = true;
+			break;
+
+			case 7: 
+				options.binSize = strtod(optarg, NULL);
+			break;
+
+			case 8: 
+				if ((sscanf(optarg, "%f:%f:%f", &resampleStart, &resampleStep, &resampleEnd) != 3) || (resampleStep <= 0)){
+					cerr << "Invalid resampling wavelengths: " << optarg << endl;
+					exit(1);
+				}
+				{
+					//count the steps instead of accumulating them, so the float error does not drop the last wavelength
+					int numSteps = (int)floor((resampleEnd - resampleStart)/(double)resampleStep + 0.5);
+					for (int i=0; i <= numSteps; i++){
+						options.resampleWlens.push_back(resampleStart + i*(double)resampleStep);
+					}
+				}
+			break;
+
+			case 9: 
+				options.populate = true;
+			break;
+
+			case 10: 
+				options.darkFilename = optarg;
+			break;
+
+			case 11: 
+				options.gainFilename = optarg;
+			break;
+
+			case 12: 
+				options.offsetFilename = optarg;
+			break;
+
+			case 13: 
+				serve = true;
+				if (optarg != NULL){
+					socketName = optarg;
+				}
+			break;
 		}
 		if (flag == -1){
 			break;
 		}
 	}
-	char *filename = argv[optind];
-	if (filename == NULL){
+	if (optind >= argc){
 		cerr << "Filename missing." << endl;
 		exit(1);
 	}
-	
-	//read hyperspectral image header
-	size_t offset;
-	vector<float> wlens;
-	HyspexHeader header;
-	hyperspectral_read_header(filename, &header);
-
-	//configure image subsets
-	if (!startline){
-		startline = 0;
-	}
-	if (!endline){
-		endline = header.lines;
-	}
-	if (!startpix){
-		startpix = 0;
+	vector<string> filenames(argv + optind, argv + argc);
+
+	//configure image subsets, end values of 0 are replaced by the full image size of each datacube
+	options.subset.startSamp = startpix;
+	options.subset.endSamp = endpix;
+	options.subset.startLine = startline;
+	options.subset.endLine = endline;
+
+	//default memory budget: half of the physical memory
+	size_t budget = memoryBudget*1024*1024;
+	if (!memoryBudget){
+		budget = sysconf(_SC_PHYS_PAGES)*sysconf(_SC_PAGE_SIZE)/2;
 	}
-	if (!endpix){
-		endpix = header.samples;
+	MemoryManager memoryManager(budget);
+
+	if (serve){
+		//headless mode, answer requests from other processes
+		QCoreApplication app(argc, argv);
+		RenderServer server(filenames, options, &memoryManager);
+		if (!server.listen(socketName)){
+			exit(1);
+		}
+		return app.exec();
 	}
-	
-	int newLines = endline - startline;
-	int newSamples = endpix - startpix;
-
-	ImageSubset subset;
-	subset.startSamp = startpix;
-	subset.endSamp = endpix;
-	subset.startLine = startline;
-	subset.endLine = endline;
-	
-	//read hyperspectral image
-	float *data = new float[newLines*newSamples*header.bands];
-	hyperspectral_read_image(filename, &header, subset, data);
-	wlens = header.wlens;
 
-	//start Qt app, display imageViewer widget
+	//start Qt app, display all datacubes in tabs
 	QApplication app(argc, argv);
-	ImageViewer viewer(data, newLines, newSamples, header.bands, wlens);
-	viewer.show();
-	
+	CubeSession session(filenames, options, &memoryManager);
+	session.show();
+
 	return app.exec();
 }	
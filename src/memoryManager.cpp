@@ -0,0 +1,90 @@
+//=======================================================================================================
+// Copyright 2015 Asgeir Bjorgan, Lise Lyngsnes Randeberg, Norwegian University of Science and Technology
+// Distributed under the MIT License.
+// (See accompanying file LICENSE or copy at
+// http://opensource.org/licenses/MIT)
+//=======================================================================================================
+
+#include "memoryManager.h"
+using namespace std;
+
+MemoryManager::MemoryManager(size_t budget) : budget(budget), usage(0), useCounter(0){
+}
+
+void MemoryManager::reserve(MemoryConsumer *owner, int id, size_t bytes, bool pinned){
+	release(owner, id);
+
+	//evict least recently used allocations until the new allocation fits
+	while (usage + bytes > budget){
+		int oldest = -1;
+		for (int i=0; i < (int)allocations.size(); i++){
+			if (!allocations[i].pinned && ((oldest == -1) || (allocations[i].lastUse < allocations[oldest].lastUse))){
+				oldest = i;
+			}
+		}
+		if (oldest == -1){
+			//nothing more to evict, go over budget
+			break;
+		}
+
+		//forget the allocation before asking the owner to free it, the owner may release further allocations in the process
+		Allocation evicted = allocations[oldest];
+		allocations.erase(allocations.begin() + oldest);
+		usage -= evicted.bytes;
+		evicted.owner->evictMemory(evicted.id);
+	}
+
+	Allocation allocation;
+	allocation.owner = owner;
+	allocation.id = id;
+	allocation.bytes = bytes;
+	allocation.lastUse = ++useCounter;
+	allocation.pinned = pinned;
+	allocations.push_back(allocation);
+	usage += bytes;
+}
+
+void MemoryManager::touch(MemoryConsumer *owner, int id){
+	int index = find(owner, id);
+	if (index != -1){
+		allocations[index].lastUse = ++useCounter;
+	}
+}
+
+void MemoryManager::setPinned(MemoryConsumer *owner, int id, bool pinned){
+	int index = find(owner, id);
+	if (index != -1){
+		allocations[index].pinned = pinned;
+		allocations[index].lastUse = ++useCounter;
+	}
+}
+
+void MemoryManager::release(MemoryConsumer *owner, int id){
+	int index = find(owner, id);
+	if (index != -1){
+		usage -= allocations[index].bytes;
+		allocations.erase(allocations.begin() + index);
+	}
+}
+
+void MemoryManager::releaseAll(MemoryConsumer *owner){
+	for (int i=allocations.size()-1; i >= 0; i--){
+		if (allocations[i].owner == owner){
+			usage -= allocations[i].bytes;
+			allocations.erase(allocations.begin() + i);
+		}
+	}
+}
+
+bool MemoryManager::contains(MemoryConsumer *owner, int id){
+	return find(owner, id) != -1;
+}
+
+int MemoryManager::find(MemoryConsumer *owner, int id){
+	for (int i=0; i < (int)allocations.size(); i++){
+		if ((allocations[i].owner == owner) && (allocations[i].id == id)){
+			return i;
+		}
+	}
+	return -1;
+}
@@ -0,0 +1,55 @@
+//=======================================================================================================
+// Copyright 2015 Asgeir Bjorgan, Lise Lyngsnes Randeberg, Norwegian University of Science and Technology
+// Distributed under the MIT License.
+// (See accompanying file LICENSE or copy at
+// http://opensource.org/licenses/MIT)
+//=======================================================================================================
+
+#ifndef MEMORYMANAGER_H_DEFINED
+#define MEMORYMANAGER_H_DEFINED
+#include <stddef.h>
+#include <vector>
+
+//Owner of memory registered in a MemoryManager.
+class MemoryConsumer{
+	public:
+		virtual ~MemoryConsumer(){};
+		virtual void evictMemory(int id) = 0; //free the memory registered under the given id. The manager has already forgotten about it.
+};
+
+//Keeps track of memory used by several owners (e.g. datacubes and rendered band images) within a global budget.
+//When a new allocation exceeds the budget, the least recently used unpinned allocations are evicted.
+class MemoryManager{
+	public:
+		MemoryManager(size_t budget);
+
+		//register an allocation of the given size, evicting other allocations as necessary. The allocation itself is done by the owner.
+		//Pin the allocation right away when the owner will use it before it gets the chance to call setPinned(), since
+		//further reservations in between (e.g. by a viewer under construction) may otherwise evict it.
+		void reserve(MemoryConsumer *owner, int id, size_t bytes, bool pinned = false);
+
+		void touch(MemoryConsumer *owner, int id); //mark allocation as recently used
+		void setPinned(MemoryConsumer *owner, int id, bool pinned); //pinned allocations are never evicted
+		void release(MemoryConsumer *owner, int id); //forget allocation, called by the owner when freeing memory by itself
+		void releaseAll(MemoryConsumer *owner);
+
+		bool contains(MemoryConsumer *owner, int id);
+		size_t getUsage(){return usage;};
+		size_t getBudget(){return budget;};
+	private:
+		typedef struct {
+			MemoryConsumer *owner;
+			int id;
+			size_t bytes;
+			long lastUse;
+			bool pinned;
+		} Allocation;
+
+		int find(MemoryConsumer *owner, int id); //index of allocation in allocations, -1 if not found
+		std::vector<Allocation> allocations;
+		size_t budget;
+		size_t usage;
+		long useCounter;
+};
+
+#endif
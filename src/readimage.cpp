@@ -11,12 +11,14 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <string>
 using namespace std;
 
 const int MAX_CHAR = 512;
 const int MAX_FILE_SIZE = 4000;
 
-int getMatch(char *string, regmatch_t *matchArray, int matchNum, char **match);
+void getMatch(char *string, regmatch_t *matchArray, int matchNum, char **match);
 
 //extract specified property value from header text as a char array
 char* getValue(char *hdrText, const char *property);
@@ -26,6 +28,61 @@ vector<float> getWavelengths(int bands, char* wavelengthStr);
 
 char *getBasename(char *filename);
 
+const size_t HUGE_PAGE_BYTES = 2*1024*1024;
+const size_t SMALL_PAGE_BYTES = 4096;
+
+//round allocation up to whole huge pages
+size_t hyperspectral_image_bytes(size_t numElements){
+	return (numElements*sizeof(float) + HUGE_PAGE_BYTES - 1)/HUGE_PAGE_BYTES*HUGE_PAGE_BYTES;
+}
+
+float *hyperspectral_alloc_image(size_t numElements, bool populate){
+	size_t bytes = hyperspectral_image_bytes(numElements);
+
+	//explicitly reserved huge pages, if there are any
+	#ifdef MAP_HUGETLB
+	void *data = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (populate ? MAP_POPULATE : 0), -1, 0);
+	if (data != MAP_FAILED){
+		return (float*)data;
+	}
+	#endif
+
+	//otherwise transparent huge pages: map with room for aligning to huge page boundary, unmap the excess
+	char *mapped = (char*)mmap(NULL, bytes + HUGE_PAGE_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mapped == MAP_FAILED){
+		fprintf(stderr, "Could not allocate %lu bytes for image.\n", (unsigned long)bytes);
+		exit(1);
+	}
+	char *aligned = (char*)(((uintptr_t)mapped + HUGE_PAGE_BYTES - 1)/HUGE_PAGE_BYTES*HUGE_PAGE_BYTES);
+	if (aligned > mapped){
+		munmap(mapped, aligned - mapped);
+	}
+	munmap(aligned + bytes, (mapped + bytes + HUGE_PAGE_BYTES) - (aligned + bytes));
+	#ifdef MADV_HUGEPAGE
+	madvise(aligned, bytes, MADV_HUGEPAGE);
+	#endif
+
+	//prefault after madvise, so that faults are served by huge pages (MAP_POPULATE would fault in small pages before the madvise)
+	if (populate){
+		hyperspectral_populate_image((float*)aligned, numElements);
+	}
+	return (float*)aligned;
+}
+
+void hyperspectral_populate_image(float *data, size_t numElements){
+	char *bytes = (char*)data;
+	size_t numBytes = hyperspectral_image_bytes(numElements);
+	for (size_t i=0; i < numBytes; i += SMALL_PAGE_BYTES){
+		bytes[i] = 0;
+	}
+}
+
+void hyperspectral_free_image(float *data, size_t numElements){
+	if (data != NULL){
+		munmap(data, hyperspectral_image_bytes(numElements));
+	}
+}
+
 void hyperspectral_read_header(char *filename, HyspexHeader *header){
 	//find base filename
 	char *baseName = getBasename(filename);
@@ -87,15 +144,69 @@ void hyperspectral_read_header(char *filename, HyspexHeader *header){
 	free(datatype);
 
 	//recap
-	fprintf(stderr, "Extracted: lines=%d, samples=%d, bands=%d, offset=%d\n", header->lines, header->samples, header->bands, header->offset);
+	fprintf(stderr, "Extracted: lines=%d, samples=%d, bands=%d, offset=%lu\n", header->lines, header->samples, header->bands, (unsigned long)header->offset);
 	fprintf(stderr, "Wavelengths: ");
-	for (int i=0; i < header->wlens.size(); i++){
+	for (int i=0; i < (int)header->wlens.size(); i++){
 		fprintf(stderr, "%f ", header->wlens[i]);
 	}
 	fprintf(stderr, "\n");
 }
 
-void hyperspectral_read_image(char *filename, HyspexHeader *header, ImageSubset subset, float *data){
+//convert a single band to float, weight and store (or add to) output. Calibrated if calibration arrays are given.
+template<typename T>
+inline void convert_band(T *input, float weight, const float *dark, const float *gain, const float *offset, bool accumulate, int numSamples, float *output){
+	if (dark == NULL){
+		if (accumulate){
+			for (int j=0; j < numSamples; j++){
+				output[j] += weight*input[j];
+			}
+		} else {
+			for (int j=0; j < numSamples; j++){
+				output[j] = weight*input[j];
+			}
+		}
+	} else {
+		if (accumulate){
+			for (int j=0; j < numSamples; j++){
+				output[j] += weight*((input[j] - dark[j])*gain[j] + offset[j]);
+			}
+		} else {
+			for (int j=0; j < numSamples; j++){
+				output[j] = weight*((input[j] - dark[j])*gain[j] + offset[j]);
+			}
+		}
+	}
+}
+
+//convert bands of a single BIL-interleaved line to float, applying radiometric calibration and spectral resampling. Output bands are stored contiguously, samples running fastest.
+//Inner loops run over contiguous samples, so that the compiler can vectorize them.
+template<typename T>
+void convert_line(T *line, int samples, ImageSubset subset, SpectralResampling *resampling, RadiometricCalibration *calibration, float *output){
+	int numSamples = subset.endSamp - subset.startSamp;
+	int numBands = resampling->startBand.size();
+
+	for (int b=0; b < numBands; b++){
+		float *outBand = output + b*numSamples;
+		vector<float> &weights = resampling->weights[b];
+
+		//first band is assigned, remaining bands are accumulated
+		for (int k=0; k < (int)weights.size(); k++){
+			int inputBand = resampling->startBand[b] + k;
+			size_t position = (size_t)inputBand*samples + subset.startSamp;
+			const float *dark = NULL;
+			const float *gain = NULL;
+			const float *offset = NULL;
+			if (calibration != NULL){
+				dark = &(calibration->dark[position]);
+				gain = &(calibration->gain[position]);
+				offset = &(calibration->offset[position]);
+			}
+			convert_band(line + position, weights[k], dark, gain, offset, k > 0, numSamples, outBand);
+		}
+	}
+}
+
+void hyperspectral_read_image(char *filename, HyspexHeader *header, ImageSubset subset, float *data, SpectralResampling *resampling, RadiometricCalibration *calibration){
 	//find number of bytes for contained element
 	size_t elementBytes = 0;
 	if (header->datatype == 4){
@@ -107,6 +218,14 @@ void hyperspectral_read_image(char *filename, HyspexHeader *header, ImageSubset
 		exit(1);
 	}
 
+	//no resampling: each output band is a copy of the corresponding input band
+	SpectralResampling identity;
+	if (resampling == NULL){
+		identity = hyperspectral_binning(header->wlens, 1);
+		resampling = &identity;
+	}
+	int numOutputBands = resampling->startBand.size();
+
 	FILE *fp = fopen(filename, "rb");
 	if (fp == NULL){
 		fprintf(stderr, "Could not open file.\n");
@@ -114,44 +233,162 @@ void hyperspectral_read_image(char *filename, HyspexHeader *header, ImageSubset
 	}
 	
 	//skip header and lines we do not want
-	size_t skipBytes = subset.startLine*header->samples*header->bands*elementBytes + header->offset;
-	fseek(fp, skipBytes, SEEK_SET);
+	size_t lineElements = (size_t)header->bands*header->samples;
+	size_t skipBytes = subset.startLine*lineElements*elementBytes + header->offset;
+	fseeko(fp, skipBytes, SEEK_SET);
 
 	int numLinesToRead = subset.endLine - subset.startLine;
-
+	int numSamples = subset.endSamp - subset.startSamp;
+	char *line = (char*)malloc(elementBytes*lineElements);
 
 	//read in line by line
 	for (int i=0; i < numLinesToRead; i++){
-		char *line = (char*)malloc(elementBytes*header->bands*header->samples);
-		int sizeRead = fread(line, elementBytes, header->bands*header->samples, fp);
+		size_t sizeRead = fread(line, elementBytes, lineElements, fp);
 		if (sizeRead == 0){
 			fprintf(stderr, "Something went extremely wrong in the file reading: %d, %d\n", ferror(fp), feof(fp));
 			exit(1);
 		}
 
-		//convert to float, copy to total array
-		for (int j=subset.startSamp; j < subset.endSamp; j++){
-			for (int k=0; k < header->bands; k++){
-				float val;
-				int position = k*header->samples + j;
-				if (header->datatype == 4){
-					val = ((float*)line)[position];
-				} else if (header->datatype == 12){
-					val = (((uint16_t*)line)[position])*1.0f;
+		//convert to float, calibrate, resample, copy to total array
+		float *output = data + (size_t)i*numOutputBands*numSamples;
+		if (header->datatype == 4){
+			convert_line((float*)line, header->samples, subset, resampling, calibration, output);
+		} else if (header->datatype == 12){
+			convert_line((uint16_t*)line, header->samples, subset, resampling, calibration, output);
+		}
+	}
+	free(line);
+	fclose(fp);
+	
+}
+
+//read calibration image, averaged over all lines. Returns constant value if filename is NULL.
+vector<float> read_calibration_array(const HyspexHeader *header, const char *filename, float defaultValue){
+	size_t lineElements = (size_t)header->samples*header->bands;
+	vector<float> values(lineElements, defaultValue);
+	if (filename == NULL){
+		return values;
+	}
+
+	string name(filename);
+	HyspexHeader calibrationHeader;
+	hyperspectral_read_header(&name[0], &calibrationHeader);
+	if ((calibrationHeader.samples != header->samples) || (calibrationHeader.bands != header->bands)){
+		fprintf(stderr, "Calibration image %s has %d samples and %d bands, image has %d samples and %d bands. Exiting.\n", filename, calibrationHeader.samples, calibrationHeader.bands, header->samples, header->bands);
+		exit(1);
+	}
+
+	ImageSubset subset;
+	subset.startSamp = 0;
+	subset.endSamp = calibrationHeader.samples;
+	subset.startLine = 0;
+	subset.endLine = calibrationHeader.lines;
+	float *data = new float[lineElements*calibrationHeader.lines];
+	hyperspectral_read_image(&name[0], &calibrationHeader, subset, data);
+
+	for (size_t j=0; j < lineElements; j++){
+		double sum = 0;
+		for (int i=0; i < calibrationHeader.lines; i++){
+			sum += data[i*lineElements + j];
+		}
+		values[j] = sum/calibrationHeader.lines;
+	}
+	delete [] data;
+	return values;
+}
+
+RadiometricCalibration hyperspectral_read_calibration(const HyspexHeader *header, const char *darkFilename, const char *gainFilename, const char *offsetFilename){
+	RadiometricCalibration calibration;
+	calibration.dark = read_calibration_array(header, darkFilename, 0.0f);
+	calibration.gain = read_calibration_array(header, gainFilename, 1.0f);
+	calibration.offset = read_calibration_array(header, offsetFilename, 0.0f);
+	return calibration;
+}
+
+SpectralResampling hyperspectral_binning(vector<float> wlens, int binSize){
+	SpectralResampling resampling;
+	for (int i=0; i < (int)wlens.size(); i += binSize){
+		int numBands = binSize;
+		if (i + numBands > (int)wlens.size()){
+			numBands = wlens.size() - i;
+		}
+
+		//average of bands and wavelengths in bin
+		float wlen = 0;
+		for (int k=0; k < numBands; k++){
+			wlen += wlens[i + k]/numBands;
+		}
+		resampling.startBand.push_back(i);
+		resampling.weights.push_back(vector<float>(numBands, 1.0f/numBands));
+		resampling.wlens.push_back(wlen);
+	}
+	return resampling;
+}
+
+SpectralResampling hyperspectral_resampling(vector<float> wlens, vector<float> targetWlens){
+	SpectralResampling resampling;
+	if (wlens.size() == 0){
+		fprintf(stderr, "Image has no wavelengths to resample from.\n");
+		exit(1);
+	}
+	for (int i=0; i < (int)targetWlens.size(); i++){
+		float wlen = targetWlens[i];
+		if ((wlen < wlens.front()) || (wlen > wlens.back())){
+			fprintf(stderr, "Target wavelength %f outside of image wavelength range, skipping.\n", wlen);
+			continue;
+		}
+
+		//half the distance to neighboring target wavelengths
+		float lowerWidth = 0;
+		float upperWidth = 0;
+		if (targetWlens.size() > 1){
+			lowerWidth = (i > 0) ? (wlen - targetWlens[i-1])/2 : (targetWlens[i+1] - wlen)/2;
+			upperWidth = (i < (int)targetWlens.size()-1) ? (targetWlens[i+1] - wlen)/2 : lowerWidth;
+		}
+
+		//input bands within the target band
+		int startBand = -1;
+		int numBands = 0;
+		for (int k=0; k < (int)wlens.size(); k++){
+			if ((wlens[k] >= wlen - lowerWidth) && (wlens[k] < wlen + upperWidth)){
+				if (startBand == -1){
+					startBand = k;
 				}
-				data[i*header->bands*(subset.endSamp - subset.startSamp) + k*(subset.endSamp - subset.startSamp) + j-subset.startSamp] = val;
+				numBands++;
 			}
 		}
-		free(line);
-
 
+		if (numBands > 0){
+			resampling.startBand.push_back(startBand);
+			resampling.weights.push_back(vector<float>(numBands, 1.0f/numBands));
+		} else if (wlens.size() < 2){
+			//single input band, nothing to interpolate between
+			resampling.startBand.push_back(0);
+			resampling.weights.push_back(vector<float>(1, 1.0f));
+		} else {
+			//target band narrower than the input band spacing, interpolate between nearest bands
+			int upper = 1;
+			while ((upper < (int)wlens.size()-1) && (wlens[upper] < wlen)){
+				upper++;
+			}
+			float upperWeight = (wlen - wlens[upper-1])/(wlens[upper] - wlens[upper-1]);
+			vector<float> weights;
+			weights.push_back(1.0f - upperWeight);
+			weights.push_back(upperWeight);
+			resampling.startBand.push_back(upper-1);
+			resampling.weights.push_back(weights);
+		}
+		resampling.wlens.push_back(wlen);
+	}
 
+	if (resampling.wlens.size() == 0){
+		fprintf(stderr, "None of the target wavelengths are within the image wavelength range (%f - %f nm).\n", wlens.front(), wlens.back());
+		exit(1);
 	}
-	fclose(fp);
-	
+	return resampling;
 }
 
-int getMatch(char *string, regmatch_t *matchArray, int matchNum, char **match){
+void getMatch(char *string, regmatch_t *matchArray, int matchNum, char **match){
 	int start = matchArray[matchNum].rm_so;
 	int end = matchArray[matchNum].rm_eo;
 	*match = (char*)malloc(sizeof(char)*(end-start+1));
@@ -170,7 +407,7 @@ char* getValue(char *hdrText, const char *property){
 	strcat(regexExpr, property);
 	strcat(regexExpr, "\\s*=\\s*([{|}|0-9|,| |.|a-z]+)"); //property followed by = and a set of number, commas, spaces or {}s
 
-	int retcode = regcomp(&propertyMatch, regexExpr, REG_EXTENDED | REG_NEWLINE);
+	regcomp(&propertyMatch, regexExpr, REG_EXTENDED | REG_NEWLINE);
 	int match = regexec(&propertyMatch, hdrText, numMatch, matchArray, 0);
 	if (match != 0){
 		fprintf(stderr, "Could not find property in header file: %s\nExiting\n", property);
@@ -192,8 +429,8 @@ char *getBasename(char *filename){
 	regex_t filenameMatch;
 	int numMatch = 2;
 	regmatch_t *matchArray = (regmatch_t*)malloc(sizeof(regmatch_t)*numMatch);
-	int retcode = regcomp(&filenameMatch, "(.*)[.].*$", REG_EXTENDED);
-	int match = regexec(&filenameMatch, filename, numMatch, matchArray, 0);
+	regcomp(&filenameMatch, "(.*)[.].*$", REG_EXTENDED);
+	regexec(&filenameMatch, filename, numMatch, matchArray, 0);
 	char *baseName;
 	getMatch(filename, matchArray, 1, &baseName);
 	regfree(&filenameMatch);
@@ -209,7 +446,7 @@ vector<float> getWavelengths(int bands, char* wavelengthStr){
 	int numMatch = 2;
 	regmatch_t *matchArray = (regmatch_t*)malloc(sizeof(regmatch_t)*numMatch);
 	char regexExpr[MAX_CHAR] = "([0-9|.]+)[,| |}]*";
-	int retcode = regcomp(&numberMatch, regexExpr, REG_EXTENDED);
+	regcomp(&numberMatch, regexExpr, REG_EXTENDED);
 	
 	//find start of number sequence
 	char *currStart = strchr(wavelengthStr, '{') + 1;
@@ -271,7 +508,7 @@ void hyperspectral_write_header(const char *filename, int numBands, int numPixel
 	hdrOut << "default bands = {55,41,12}" << endl;
 	hdrOut << "byte order = 0" << endl;
 	hdrOut << "wavelength = {";
-	for (int i=0; i < wlens.size(); i++){
+	for (int i=0; i < (int)wlens.size(); i++){
 		hdrOut << wlens[i] << " ";
 	}
 	hdrOut << "}" << endl;
@@ -286,7 +523,7 @@ void hyperspectral_write_image(const char *filename, int numBands, int numPixels
 	
 	//write image
 	for (int i=0; i < numLines; i++){
-		float *write_data = data + i*numBands*numPixels;
+		float *write_data = data + (size_t)i*numBands*numPixels;
 		hyspexOut->write((char*)(write_data), sizeof(float)*numBands*numPixels);
 	}
 
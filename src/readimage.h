@@ -8,12 +8,14 @@
 #ifndef READIMAGE_H_DEFINED
 #define READIMAGE_H_DEFINED
 #include <vector>
+#include <stddef.h>
 
+//Image dimensions fit in ints, but their products may not: sizes and offsets in the datacube are computed as size_t.
 typedef struct {
 	int samples;
 	int bands;
 	int lines;
-	int offset;
+	size_t offset;
 	std::vector<float> wlens;
 	int datatype;
 } HyspexHeader;
@@ -24,9 +26,40 @@ typedef struct {
 	int startLine;
 	int endLine;
 } ImageSubset;
+
+//Spectral resampling applied while reading the image. Output band b is the weighted sum of input bands startBand[b], startBand[b]+1, ..., startBand[b]+weights[b].size()-1.
+typedef struct {
+	std::vector<int> startBand;
+	std::vector<std::vector<float> > weights;
+	std::vector<float> wlens; //wavelengths of the output bands
+} SpectralResampling;
+
+//Radiometric calibration applied while reading the image, before spectral resampling: value = (raw - dark)*gain + offset.
+//Arrays contain bands x samples values (one BIL-interleaved line of the full image width).
+typedef struct {
+	std::vector<float> dark;
+	std::vector<float> gain;
+	std::vector<float> offset;
+} RadiometricCalibration;
+
+//read calibration arrays from ENVI images with the same samples and bands as the image described by header. Images with several lines are averaged over the lines (e.g. a stack of dark frames).
+//Filenames set to NULL are not used, and default to no dark subtraction, unit gain or zero offset.
+RadiometricCalibration hyperspectral_read_calibration(const HyspexHeader *header, const char *darkFilename, const char *gainFilename, const char *offsetFilename);
+
+//average each binSize adjacent bands
+SpectralResampling hyperspectral_binning(std::vector<float> wlens, int binSize);
+
+//resample to target wavelengths: average of input bands within half the target spacing of each target wavelength, or linear interpolation between the nearest input bands if there are none. Target wavelengths outside the input range are skipped, exits if none are left.
+SpectralResampling hyperspectral_resampling(std::vector<float> wlens, std::vector<float> targetWlens);
 	
+//allocate float array for a datacube, aligned to and preferably backed by 2 MB huge pages to reduce TLB misses on strided band access. Page faults are taken at allocation instead of first access if populate is set.
+float *hyperspectral_alloc_image(size_t numElements, bool populate = false);
+//fault in the pages of a datacube allocated without populate, e.g. from a loader thread before filling it
+void hyperspectral_populate_image(float *data, size_t numElements);
+void hyperspectral_free_image(float *data, size_t numElements);
+
 void hyperspectral_read_header(char *filename, HyspexHeader *header);
-void hyperspectral_read_image(char *filename, HyspexHeader *header, ImageSubset subset, float *data);
+void hyperspectral_read_image(char *filename, HyspexHeader *header, ImageSubset subset, float *data, SpectralResampling *resampling = NULL, RadiometricCalibration *calibration = NULL); //data will contain resampling->wlens.size() bands if resampling is specified, header->bands otherwise
 
 
 void hyperspectral_write_header(const char *filename, int bands, int samples, int lines, std::vector<float> wlens);
@@ -0,0 +1,405 @@
+//=======================================================================================================
+// Copyright 2015 Asgeir Bjorgan, Lise Lyngsnes Randeberg, Norwegian University of Science and Technology
+// Distributed under the MIT License.
+// (See accompanying file LICENSE or copy at
+// http://opensource.org/licenses/MIT)
+//=======================================================================================================
+
+#include "renderServer.h"
+#include "bandStatistics.h"
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QBuffer>
+#include <QImage>
+#include <sstream>
+#include <algorithm>
+#include <stdio.h>
+using namespace std;
+
+//time to wait for an existing server to accept a connection before considering its socket stale (ms)
+const int STALE_SOCKET_TIMEOUT = 1000;
+
+//memory manager id of the data of a datacube. Rendered images have ids >= 0.
+int cubeDataId(int cube){
+	return -1 - cube;
+}
+
+RenderServer::RenderServer(vector<string> filenames, CubeOptions options, MemoryManager *memoryManager, QObject *parent) : QObject(parent), options(options), memoryManager(memoryManager), nextRenderedId(0){
+	server = new QLocalServer(this);
+	connect(server, SIGNAL(newConnection()), SLOT(acceptConnection()));
+
+	//read headers, datacubes are loaded on the first request
+	for (int i=0; i < (int)filenames.size(); i++){
+		ServedCube cube;
+		cube.filename = filenames[i];
+		cube.data = NULL;
+		cube.dataElements = 0;
+		cube.cache = NULL;
+		cube.resample = false;
+		if (cubecache_is_cache_file(cube.filename.c_str())){
+			cube.cache = cubecache_open(cube.filename.c_str());
+			cube.header = cube.cache->header;
+			warnCubeCacheOptions(options, cube.filename);
+
+			//decoded blocks are accounted for as the data of the datacube, limited as in CubeTab
+			cube.cache->maxDecodedBytes = min(cube.cache->maxDecodedBytes, memoryManager->getBudget()/4);
+		} else {
+			hyperspectral_read_header(&cube.filename[0], &cube.header);
+			cube.resample = getCubeResampling(options, cube.header, &cube.resampling);
+		}
+
+		cube.subset = getCubeSubset(options, cube.header);
+		cube.lines = cube.subset.endLine - cube.subset.startLine;
+		cube.samples = cube.subset.endSamp - cube.subset.startSamp;
+		cube.bands = cube.resample ? cube.resampling.wlens.size() : cube.header.bands;
+		cube.wlens = cube.resample ? cube.resampling.wlens : cube.header.wlens;
+
+		if ((cube.lines <= 0) || (cube.samples <= 0) || (cube.bands <= 0)){
+			fprintf(stderr, "Empty image subset: %s\n", cube.filename.c_str());
+			exit(1);
+		}
+		cubes.push_back(cube);
+	}
+}
+
+RenderServer::~RenderServer(){
+	memoryManager->releaseAll(this);
+	for (int i=0; i < (int)cubes.size(); i++){
+		hyperspectral_free_image(cubes[i].data, cubes[i].dataElements);
+		if (cubes[i].cache != NULL){
+			cubecache_close(cubes[i].cache);
+		}
+	}
+}
+
+bool RenderServer::listen(string socketName){
+	QString name = QString::fromStdString(socketName);
+	bool listening = server->listen(name);
+
+	//the socket file can be left behind by a server that was not shut down properly. Remove it only if nobody answers on it.
+	if (!listening && (server->serverError() == QAbstractSocket::AddressInUseError)){
+		QLocalSocket existing;
+		existing.connectToServer(name);
+		if (existing.waitForConnected(STALE_SOCKET_TIMEOUT)){
+			fprintf(stderr, "Another server is already listening on %s\n", socketName.c_str());
+			return false;
+		}
+		QLocalServer::removeServer(name);
+		listening = server->listen(name);
+	}
+
+	if (!listening){
+		fprintf(stderr, "Could not listen on %s: %s\n", socketName.c_str(), server->errorString().toStdString().c_str());
+		return false;
+	}
+	fprintf(stderr, "Serving %d datacube(s) on %s\n", (int)cubes.size(), server->fullServerName().toStdString().c_str());
+	return true;
+}
+
+void RenderServer::evictMemory(int id){
+	if (id < 0){
+		ServedCube *cube = &cubes[-1 - id];
+		if (cube->cache != NULL){
+			cubecache_clear_decoded(cube->cache);
+		}
+		hyperspectral_free_image(cube->data, cube->dataElements);
+		cube->data = NULL;
+		cube->dataElements = 0;
+		return;
+	}
+
+	map<int, RenderedImage>::iterator image = renderedImages.find(id);
+	if (image != renderedImages.end()){
+		renderedIds.erase(image->second.key);
+		renderedImages.erase(image);
+	}
+}
+
+void RenderServer::acceptConnection(){
+	while (server->hasPendingConnections()){
+		QLocalSocket *socket = server->nextPendingConnection();
+		connect(socket, SIGNAL(readyRead()), SLOT(handleRequests()));
+		connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+	}
+}
+
+void RenderServer::handleRequests(){
+	QLocalSocket *socket = qobject_cast<QLocalSocket*>(sender());
+	while (socket->canReadLine()){
+		QByteArray request = socket->readLine().trimmed();
+		if (request.size() > 0){
+			handleRequest(socket, request.toStdString());
+		}
+	}
+}
+
+void RenderServer::writeResponse(QLocalSocket *socket, const char *payload, size_t bytes){
+	ostringstream header;
+	header << "OK " << bytes << endl;
+	socket->write(header.str().c_str());
+	socket->write(payload, bytes);
+}
+
+void RenderServer::writeError(QLocalSocket *socket, string message){
+	socket->write(("ERROR " + message + "\n").c_str());
+}
+
+void RenderServer::loadCube(int cube){
+	ServedCube *served = &cubes[cube];
+	if (memoryManager->contains(this, cubeDataId(cube))){
+		memoryManager->touch(this, cubeDataId(cube));
+		return;
+	}
+
+	if (served->cache != NULL){
+		//blocks are read from the cube cache file on demand, only the decoded blocks are kept in memory
+		memoryManager->reserve(this, cubeDataId(cube), served->cache->maxDecodedBytes);
+		return;
+	}
+
+	served->dataElements = (size_t)served->lines*served->samples*served->bands;
+	memoryManager->reserve(this, cubeDataId(cube), sizeof(float)*served->dataElements);
+	served->data = hyperspectral_alloc_image(served->dataElements, options.populate);
+
+	RadiometricCalibration calibration;
+	bool calibrate = getCubeCalibration(options, served->header, &calibration);
+	hyperspectral_read_image(&served->filename[0], &served->header, served->subset, served->data, served->resample ? &served->resampling : NULL, calibrate ? &calibration : NULL);
+}
+
+float *RenderServer::getBandLine(int cube, int band, int line){
+	ServedCube *served = &cubes[cube];
+	return served->data + (size_t)line*served->samples*served->bands + (size_t)band*served->samples;
+}
+
+RenderedImage *RenderServer::findImage(vector<int> key){
+	map<vector<int>, int>::iterator id = renderedIds.find(key);
+	if (id == renderedIds.end()){
+		return NULL;
+	}
+	memoryManager->setPinned(this, id->second, true);
+	return &renderedImages[id->second];
+}
+
+RenderedImage *RenderServer::addImage(vector<int> key, int channels){
+	ServedCube *served = &cubes[key[0]];
+	int id = nextRenderedId++;
+	memoryManager->reserve(this, id, (size_t)served->lines*served->samples*channels, true);
+
+	RenderedImage *image = &renderedImages[id];
+	image->key = key;
+	image->id = id;
+	image->width = served->samples;
+	image->height = served->lines;
+	image->channels = channels;
+	image->pixels.resize((size_t)served->lines*served->samples*channels);
+	renderedIds[key] = id;
+	return image;
+}
+
+void RenderServer::releaseImage(RenderedImage *image){
+	memoryManager->setPinned(this, image->id, false);
+}
+
+RenderedImage *RenderServer::getBand(int cube, int band){
+	vector<int> key;
+	key.push_back(cube);
+	key.push_back(band);
+	RenderedImage *image = findImage(key);
+	if (image != NULL){
+		return image;
+	}
+
+	//get band image from the datacube, keep the datacube in memory while rendering
+	ServedCube *served = &cubes[cube];
+	loadCube(cube);
+	memoryManager->setPinned(this, cubeDataId(cube), true);
+	vector<float> bandImage;
+	if (served->cache != NULL){
+		bandImage.resize((size_t)served->lines*served->samples);
+		cubecache_read_band(served->cache, served->subset, band, &bandImage[0]);
+	}
+	float *bandLine;
+
+	//same dynamic range as in the viewer
+	BandStatistics stats;
+	band_statistics_reset(&stats);
+	for (int i=0; i < served->lines; i++){
+		bandLine = (served->cache != NULL) ? &bandImage[(size_t)i*served->samples] : getBandLine(cube, band, i);
+		band_statistics_accumulate(&stats, bandLine, served->samples);
+	}
+	float min, max;
+	band_statistics_range(&stats, &min, &max);
+
+	image = addImage(key, 1);
+	for (int i=0; i < served->lines; i++){
+		bandLine = (served->cache != NULL) ? &bandImage[(size_t)i*served->samples] : getBandLine(cube, band, i);
+		band_to_greyscale(bandLine, served->samples, min, max, &image->pixels[(size_t)i*served->samples]);
+	}
+
+	memoryManager->setPinned(this, cubeDataId(cube), false);
+	return image;
+}
+
+RenderedImage *RenderServer::getComposite(int cube, int red, int green, int blue){
+	vector<int> key;
+	key.push_back(cube);
+	key.push_back(red);
+	key.push_back(green);
+	key.push_back(blue);
+	RenderedImage *image = findImage(key);
+	if (image != NULL){
+		return image;
+	}
+
+	//interleave the three rendered bands, which are kept from being evicted until the composite is done
+	RenderedImage *bandImages[3];
+	bandImages[0] = getBand(cube, red);
+	bandImages[1] = getBand(cube, green);
+	bandImages[2] = getBand(cube, blue);
+	image = addImage(key, 3);
+	size_t numPixels = image->pixels.size()/3;
+	for (int i=0; i < 3; i++){
+		for (size_t j=0; j < numPixels; j++){
+			image->pixels[j*3 + i] = bandImages[i]->pixels[j];
+		}
+	}
+	for (int i=0; i < 3; i++){
+		releaseImage(bandImages[i]);
+	}
+	return image;
+}
+
+//encode image data as PNG
+QByteArray encodePNG(const unsigned char *imageData, int width, int height, int channels){
+	QImage::Format format = (channels == 3) ? QImage::Format_RGB888 : QImage::Format_Grayscale8;
+	QImage image(imageData, width, height, channels*width, format);
+	QByteArray png;
+	QBuffer buffer(&png);
+	buffer.open(QIODevice::WriteOnly);
+	image.save(&buffer, "PNG");
+	return png;
+}
+
+void RenderServer::writeImage(QLocalSocket *socket, RenderedImage *image, string format){
+	if (format == "raw"){
+		writeResponse(socket, (const char*)&image->pixels[0], image->pixels.size());
+		return;
+	}
+
+	//encode once, repeated requests are answered directly from the cached encoding
+	if (image->png.isEmpty()){
+		image->png = encodePNG(&image->pixels[0], image->width, image->height, image->channels);
+		memoryManager->reserve(this, image->id, image->pixels.size() + image->png.size(), true);
+	}
+	writeResponse(socket, image->png.constData(), image->png.size());
+}
+
+void RenderServer::handleRequest(QLocalSocket *socket, string request){
+	istringstream arguments(request);
+	string command;
+	arguments >> command;
+
+	if (command == "LIST"){
+		ostringstream response;
+		for (int i=0; i < (int)cubes.size(); i++){
+			response << i << " " << cubes[i].lines << " " << cubes[i].samples << " " << cubes[i].bands << " " << cubes[i].filename << endl;
+		}
+		writeResponse(socket, response.str().c_str(), response.str().size());
+		return;
+	}
+
+	//all other requests refer to a datacube
+	int cube = -1;
+	arguments >> cube;
+	if (arguments.fail() || (cube < 0) || (cube >= (int)cubes.size())){
+		writeError(socket, "invalid datacube index");
+		return;
+	}
+	ServedCube *served = &cubes[cube];
+
+	if (command == "WAVELENGTHS"){
+		ostringstream response;
+		for (int i=0; i < served->bands; i++){
+			response << served->wlens[i] << endl;
+		}
+		writeResponse(socket, response.str().c_str(), response.str().size());
+	} else if ((command == "BAND") || (command == "RGB")){
+		//requested bands, optionally followed by output format
+		int numBands = (command == "BAND") ? 1 : 3;
+		int bands[3];
+		for (int i=0; i < numBands; i++){
+			arguments >> bands[i];
+			if (arguments.fail() || (bands[i] < 0) || (bands[i] >= served->bands)){
+				writeError(socket, "invalid band");
+				return;
+			}
+		}
+		string format = "png";
+		arguments >> format;
+		if ((format != "png") && (format != "raw")){
+			writeError(socket, "invalid format, should be png or raw");
+			return;
+		}
+
+		RenderedImage *image = (numBands == 1) ? getBand(cube, bands[0]) : getComposite(cube, bands[0], bands[1], bands[2]);
+		writeImage(socket, image, format);
+		releaseImage(image);
+	} else if (command == "SPECTRUM"){
+		int line, sample;
+		arguments >> line >> sample;
+		if (arguments.fail() || (line < 0) || (line >= served->lines) || (sample < 0) || (sample >= served->samples)){
+			writeError(socket, "invalid pixel");
+			return;
+		}
+
+		vector<float> spectrum(served->bands);
+		loadCube(cube);
+		if (served->cache != NULL){
+			cubecache_read_spectrum(served->cache, served->subset, line, sample, &spectrum[0]);
+		} else {
+			for (int i=0; i < served->bands; i++){
+				spectrum[i] = getBandLine(cube, i, line)[sample];
+			}
+		}
+		writeResponse(socket, (const char*)&spectrum[0], sizeof(float)*spectrum.size());
+	} else if (command == "ROI"){
+		int startLine, startSample, endLine, endSample;
+		arguments >> startLine >> startSample >> endLine >> endSample;
+		if (arguments.fail() || (startLine < 0) || (startSample < 0) || (endLine > served->lines) || (endSample > served->samples) || (startLine >= endLine) || (startSample >= endSample)){
+			writeError(socket, "invalid region");
+			return;
+		}
+		int roiLines = endLine - startLine;
+		int roiSamples = endSample - startSample;
+
+		//region relative to the full image, for reading from cube cache files
+		ImageSubset roi = served->subset;
+		roi.startLine += startLine;
+		roi.endLine = roi.startLine + roiLines;
+		roi.startSamp += startSample;
+		roi.endSamp = roi.startSamp + roiSamples;
+		vector<float> bandImage;
+		if (served->cache != NULL){
+			bandImage.resize((size_t)roiLines*roiSamples);
+		}
+
+		loadCube(cube);
+		ostringstream response;
+		for (int i=0; i < served->bands; i++){
+			if (served->cache != NULL){
+				cubecache_read_band(served->cache, roi, i, &bandImage[0]);
+			}
+
+			BandStatistics stats;
+			band_statistics_reset(&stats);
+			for (int j=0; j < roiLines; j++){
+				float *bandLine = (served->cache != NULL) ? &bandImage[(size_t)j*roiSamples] : getBandLine(cube, i, startLine + j) + startSample;
+				band_statistics_accumulate(&stats, bandLine, roiSamples);
+			}
+			response << served->wlens[i] << " " << stats.n << " " << stats.mean << " " << band_statistics_std(&stats) << " " << stats.min << " " << stats.max << endl;
+		}
+		writeResponse(socket, response.str().c_str(), response.str().size());
+	} else {
+		writeError(socket, "unknown request " + command);
+	}
+}
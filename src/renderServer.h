@@ -0,0 +1,103 @@
+//=======================================================================================================
+// Copyright 2015 Asgeir Bjorgan, Lise Lyngsnes Randeberg, Norwegian University of Science and Technology
+// Distributed under the MIT License.
+// (See accompanying file LICENSE or copy at
+// http://opensource.org/licenses/MIT)
+//=======================================================================================================
+
+#ifndef RENDERSERVER_H_DEFINED
+#define RENDERSERVER_H_DEFINED
+
+#include <QObject>
+#include <QByteArray>
+#include <string>
+#include <vector>
+#include <map>
+#include "readimage.h"
+#include "cubecache.h"
+#include "cubeSession.h"
+#include "memoryManager.h"
+
+class QLocalServer;
+class QLocalSocket;
+
+//datacube served by a RenderServer
+typedef struct {
+	std::string filename;
+	HyspexHeader header;
+	ImageSubset subset;
+	int lines;
+	int samples;
+	int bands;
+	std::vector<float> wlens;
+	bool resample;
+	SpectralResampling resampling;
+
+	//datacube contents, either read fully into memory on the first request or read on demand from a cube cache file
+	float *data;
+	size_t dataElements;
+	CubeCache *cache;
+} ServedCube;
+
+//band image or RGB composite rendered to 8-bit pixels, and its PNG encoding once requested
+typedef struct {
+	std::vector<int> key; //datacube index followed by the band index (greyscale image) or the red, green and blue band indices (RGB composite)
+	int id; //memory manager id
+	int width;
+	int height;
+	int channels;
+	std::vector<unsigned char> pixels;
+	QByteArray png;
+} RenderedImage;
+
+//Headless mode of hyview: keeps datacubes loaded and answers requests from other processes over a local socket
+//(Unix domain socket). Rendered band images and RGB composites are kept in a cache shared between all clients, so that
+//repeated requests for the same image only copy it to the socket. Datacubes and rendered images are accounted
+//for in the memory manager, and the least recently used are evicted when exceeding the budget.
+//
+//Requests are single lines of text, answered in order:
+//  LIST                                             text, one line per datacube: index lines samples bands filename
+//  WAVELENGTHS cube                                 text, one wavelength per line
+//  BAND cube band [png|raw]                         greyscale band image, raw is lines x samples bytes
+//  RGB cube red green blue [png|raw]                composite of three bands, raw is lines x samples x 3 bytes
+//  SPECTRUM cube line sample                        bands float32 values, native byte order
+//  ROI cube startLine startSample endLine endSample text, one line per band: wavelength count mean std min max
+//Each response starts with "OK <number of bytes>\n", followed by the payload, or is a single "ERROR <message>\n" line.
+//Band images use the same dynamic range as the viewer (see BandStatistics). The end of a ROI is exclusive.
+class RenderServer : public QObject, public MemoryConsumer{
+	Q_OBJECT
+	public:
+		RenderServer(std::vector<std::string> filenames, CubeOptions options, MemoryManager *memoryManager, QObject *parent = NULL);
+		~RenderServer();
+		bool listen(std::string socketName); //start listening on the given local socket name or path, returns false on failure or if another server is listening there
+		void evictMemory(int id);
+	private slots:
+		void acceptConnection();
+		void handleRequests();
+	private:
+		void handleRequest(QLocalSocket *socket, std::string request);
+		void writeResponse(QLocalSocket *socket, const char *payload, size_t bytes);
+		void writeError(QLocalSocket *socket, std::string message);
+		void writeImage(QLocalSocket *socket, RenderedImage *image, std::string format);
+
+		void loadCube(int cube); //read datacube into memory, or account for the decoded blocks of a cube cache file, if necessary
+		float *getBandLine(int cube, int band, int line); //band line of a datacube loaded into memory
+
+		//rendered images are returned pinned, to be unpinned by the caller through releaseImage()
+		RenderedImage *findImage(std::vector<int> key); //get image from the cache of rendered images, NULL if not there
+		RenderedImage *addImage(std::vector<int> key, int channels); //reserve memory for a new rendered image
+		RenderedImage *getBand(int cube, int band);
+		RenderedImage *getComposite(int cube, int red, int green, int blue);
+		void releaseImage(RenderedImage *image);
+
+		std::vector<ServedCube> cubes;
+		CubeOptions options;
+		MemoryManager *memoryManager;
+		QLocalServer *server;
+
+		std::map<int, RenderedImage> renderedImages; //indexed by memory manager id
+		std::map<std::vector<int>, int> renderedIds; //memory manager id of each rendered image, indexed by its key
+		int nextRenderedId;
+};
+
+#endif